@@ -0,0 +1,25 @@
+#ifndef ESP_BT_MAIN_H
+#define ESP_BT_MAIN_H
+
+/* Host mock of the Bluedroid host stack API */
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+typedef struct {
+    bool ssp_en;
+} esp_bluedroid_config_t;
+
+#define BT_BLUEDROID_INIT_CONFIG_DEFAULT() {.ssp_en = true}
+
+esp_err_t esp_bluedroid_init_with_cfg(esp_bluedroid_config_t *cfg);
+
+/**
+ * @brief Enable the host stack, which starts delivering GAP events.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t esp_bluedroid_enable(void);
+
+#endif /* ESP_BT_MAIN_H */
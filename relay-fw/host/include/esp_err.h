@@ -0,0 +1,52 @@
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+/* Host mock of the ESP-IDF error codes, see the ESP-IDF documentation */
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+typedef int esp_err_t;
+
+#define ESP_OK                0
+#define ESP_FAIL              -1
+#define ESP_ERR_NO_MEM        0x101
+#define ESP_ERR_INVALID_ARG   0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE  0x104
+#define ESP_ERR_NOT_FOUND     0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT       0x107
+#define ESP_ERR_INVALID_CRC   0x109
+
+/**
+ * @brief Get the name of an error code.
+ *
+ * @param code The error code.
+ *
+ * @return const char* The error code's name.
+ */
+const char *esp_err_to_name(esp_err_t code);
+
+/**
+ * @brief Abort the relay on an error returned by an ESP-IDF call.
+ *
+ * @param code       The error code.
+ * @param file       The file of the failed call.
+ * @param line       The line of the failed call.
+ * @param expression The failed call.
+ */
+void _esp_error_check_failed(esp_err_t code, const char *file, int line,
+                             const char *expression)
+    __attribute__((noreturn));
+
+#define ESP_ERROR_CHECK(x)                                            \
+    do {                                                              \
+        esp_err_t err_rc_ = (x);                                      \
+        if (err_rc_ != ESP_OK) {                                      \
+            _esp_error_check_failed(err_rc_, __FILE__, __LINE__, #x); \
+        }                                                             \
+    } while (0)
+
+#endif /* ESP_ERR_H */
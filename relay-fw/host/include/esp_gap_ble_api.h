@@ -0,0 +1,159 @@
+#ifndef ESP_GAP_BLE_API_H
+#define ESP_GAP_BLE_API_H
+
+/* Host mock of the Bluedroid GAP API. Like the real stack, the mock completes
+ * every command asynchronously by calling the GAP event handler from a
+ * separate task, and logs the advertisements that go on air. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_bt_defs.h"
+#include "esp_err.h"
+
+#define ESP_BLE_GAP_SET_EXT_ADV_PROP_LEGACY_IND 0x13
+#define ESP_BLE_GAP_PHY_1M                      1
+#define ESP_BLE_GAP_PRI_PHY_1M                  ESP_BLE_GAP_PHY_1M
+#define EXT_ADV_TX_PWR_NO_PREFERENCE            127
+#define ESP_BLE_ADV_DATA_LEN_MAX                31
+#define EXT_ADV_NUM_SETS_MAX                    10
+
+typedef enum {
+    ADV_TYPE_IND             = 0x00,
+    ADV_TYPE_DIRECT_IND_HIGH = 0x01,
+    ADV_TYPE_SCAN_IND        = 0x02,
+    ADV_TYPE_NONCONN_IND     = 0x03,
+    ADV_TYPE_DIRECT_IND_LOW  = 0x04,
+} esp_ble_adv_type_t;
+
+typedef enum {
+    BLE_ADDR_TYPE_PUBLIC     = 0x00,
+    BLE_ADDR_TYPE_RANDOM     = 0x01,
+    BLE_ADDR_TYPE_RPA_PUBLIC = 0x02,
+    BLE_ADDR_TYPE_RPA_RANDOM = 0x03,
+} esp_ble_addr_type_t;
+
+typedef enum {
+    ADV_CHNL_37  = 0x01,
+    ADV_CHNL_38  = 0x02,
+    ADV_CHNL_39  = 0x04,
+    ADV_CHNL_ALL = 0x07,
+} esp_ble_adv_channel_t;
+
+typedef enum {
+    ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY = 0x00,
+    ADV_FILTER_ALLOW_SCAN_WLST_CON_ANY,
+    ADV_FILTER_ALLOW_SCAN_ANY_CON_WLST,
+    ADV_FILTER_ALLOW_SCAN_WLST_CON_WLST,
+} esp_ble_adv_filter_t;
+
+typedef struct {
+    uint16_t              adv_int_min;
+    uint16_t              adv_int_max;
+    esp_ble_adv_type_t    adv_type;
+    esp_ble_addr_type_t   own_addr_type;
+    esp_bd_addr_t         peer_addr;
+    esp_ble_addr_type_t   peer_addr_type;
+    esp_ble_adv_channel_t channel_map;
+    esp_ble_adv_filter_t  adv_filter_policy;
+} esp_ble_adv_params_t;
+
+typedef uint16_t esp_ble_ext_adv_type_mask_t;
+typedef uint8_t  esp_ble_gap_phy_t;
+typedef uint8_t  esp_ble_gap_pri_phy_t;
+
+typedef struct {
+    esp_ble_ext_adv_type_mask_t type;
+    uint32_t                    interval_min;
+    uint32_t                    interval_max;
+    esp_ble_adv_channel_t       channel_map;
+    esp_ble_addr_type_t         own_addr_type;
+    esp_ble_addr_type_t         peer_addr_type;
+    esp_bd_addr_t               peer_addr;
+    esp_ble_adv_filter_t        filter_policy;
+    int8_t                      tx_power;
+    esp_ble_gap_pri_phy_t       primary_phy;
+    uint8_t                     max_skip;
+    esp_ble_gap_phy_t           secondary_phy;
+    uint8_t                     sid;
+    bool                        scan_req_notif;
+} esp_ble_gap_ext_adv_params_t;
+
+typedef struct {
+    uint8_t instance;
+    int     duration;
+    uint8_t max_events;
+} esp_ble_gap_ext_adv_t;
+
+typedef enum {
+    ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_ADV_START_COMPLETE_EVT,
+    ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_SET_STATIC_RAND_ADDR_EVT,
+    ESP_GAP_BLE_EXT_ADV_SET_RAND_ADDR_COMPLETE_EVT,
+    ESP_GAP_BLE_EXT_ADV_SET_PARAMS_COMPLETE_EVT,
+    ESP_GAP_BLE_EXT_ADV_DATA_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_EXT_ADV_START_COMPLETE_EVT,
+    ESP_GAP_BLE_EXT_ADV_STOP_COMPLETE_EVT,
+} esp_gap_ble_cb_event_t;
+
+typedef union {
+    struct ble_adv_data_raw_cmpl_evt_param {
+        esp_bt_status_t status;
+    } adv_data_raw_cmpl;
+    struct ble_adv_start_cmpl_evt_param {
+        esp_bt_status_t status;
+    } adv_start_cmpl;
+    struct ble_adv_stop_cmpl_evt_param {
+        esp_bt_status_t status;
+    } adv_stop_cmpl;
+    struct ble_set_rand_cmpl_evt_param {
+        esp_bt_status_t status;
+    } set_rand_addr_cmpl;
+    struct ble_ext_adv_set_rand_addr_cmpl_param {
+        esp_bt_status_t status;
+        uint8_t         instance;
+    } ext_adv_set_rand_addr;
+    struct ble_ext_adv_set_params_cmpl_param {
+        esp_bt_status_t status;
+        uint8_t         instance;
+    } ext_adv_set_params;
+    struct ble_ext_adv_data_set_cmpl_param {
+        esp_bt_status_t status;
+        uint8_t         instance;
+    } ext_adv_data_set;
+    struct ble_ext_adv_start_cmpl_param {
+        esp_bt_status_t status;
+        uint8_t         instance_num;
+        uint8_t         instance[EXT_ADV_NUM_SETS_MAX];
+    } ext_adv_start;
+    struct ble_ext_adv_stop_cmpl_param {
+        esp_bt_status_t status;
+        uint8_t         instance_num;
+        uint8_t         instance[EXT_ADV_NUM_SETS_MAX];
+    } ext_adv_stop;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t  event,
+                                 esp_ble_gap_cb_param_t *param);
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+
+esp_err_t esp_ble_gap_set_rand_addr(esp_bd_addr_t rand_addr);
+esp_err_t esp_ble_gap_config_adv_data_raw(uint8_t *raw_data, uint32_t raw_len);
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params);
+esp_err_t esp_ble_gap_stop_advertising(void);
+
+esp_err_t esp_ble_gap_ext_adv_set_params(
+    uint8_t instance, const esp_ble_gap_ext_adv_params_t *params);
+esp_err_t esp_ble_gap_ext_adv_set_rand_addr(uint8_t       instance,
+                                            esp_bd_addr_t rand_addr);
+esp_err_t esp_ble_gap_config_ext_adv_data_raw(uint8_t        instance,
+                                              uint16_t       length,
+                                              const uint8_t *data);
+esp_err_t esp_ble_gap_ext_adv_start(uint8_t                      num_adv,
+                                    const esp_ble_gap_ext_adv_t *ext_adv);
+esp_err_t esp_ble_gap_ext_adv_stop(uint8_t        num_adv,
+                                   const uint8_t *ext_adv_inst);
+
+#endif /* ESP_GAP_BLE_API_H */
@@ -0,0 +1,88 @@
+#ifndef ESP_HTTP_CLIENT_H
+#define ESP_HTTP_CLIENT_H
+
+/* Host mock of the ESP-IDF HTTP client. It's a plain HTTP/1.1 client on top
+ * of the host's sockets, which raises the same events as the ESP-IDF client
+ * while the response streams in. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define ESP_ERR_HTTP_BASE              0x7000
+#define ESP_ERR_HTTP_CONNECT           (ESP_ERR_HTTP_BASE + 2)
+#define ESP_ERR_HTTP_WRITE_DATA        (ESP_ERR_HTTP_BASE + 3)
+#define ESP_ERR_HTTP_FETCH_HEADER      (ESP_ERR_HTTP_BASE + 4)
+#define ESP_ERR_HTTP_INVALID_TRANSPORT (ESP_ERR_HTTP_BASE + 5)
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef enum {
+    HTTP_EVENT_ERROR,
+    HTTP_EVENT_ON_CONNECTED,
+    HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA,
+    HTTP_EVENT_ON_FINISH,
+    HTTP_EVENT_DISCONNECTED,
+    HTTP_EVENT_REDIRECT,
+} esp_http_client_event_id_t;
+
+typedef struct esp_http_client_event {
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t   client;
+    void                      *data;
+    int                        data_len;
+    void                      *user_data;
+    char                      *header_key;
+    char                      *header_value;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *evt);
+
+typedef enum {
+    HTTP_METHOD_GET,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_DELETE,
+} esp_http_client_method_t;
+
+typedef struct {
+    const char              *url;
+    esp_http_client_method_t method;
+    int                      timeout_ms;
+    bool                     disable_auto_redirect;
+    http_event_handle_cb     event_handler;
+    int                      buffer_size;
+    void                    *user_data;
+    bool                     keep_alive_enable;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(
+    const esp_http_client_config_t *config);
+
+/**
+ * @brief Perform a request and stream in the response.
+ *
+ * Only plain http:// URLs are supported. Redirects aren't followed.
+ *
+ * @param client The client.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client);
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client,
+                                  const char              *url);
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client,
+                                     esp_http_client_method_t method);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client,
+                                     const char *key, const char *value);
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client,
+                                         const char *data, int len);
+int       esp_http_client_get_status_code(esp_http_client_handle_t client);
+int64_t   esp_http_client_get_content_length(esp_http_client_handle_t client);
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+#endif /* ESP_HTTP_CLIENT_H */
@@ -0,0 +1,74 @@
+#ifndef ESP_HTTP_SERVER_H
+#define ESP_HTTP_SERVER_H
+
+/* Host mock of the ESP-IDF HTTP server. It serves one request per connection
+ * from a single task, which is all the relay needs. */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+#define HTTPD_MAX_URI_LEN 512
+
+typedef void *httpd_handle_t;
+
+typedef enum {
+    HTTP_DELETE = 0,
+    HTTP_GET    = 1,
+    HTTP_HEAD   = 2,
+    HTTP_POST   = 3,
+    HTTP_PUT    = 4,
+} httpd_method_t;
+
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int            method;
+    const char    *uri;
+    size_t         content_len;
+    void          *aux;
+    void          *user_ctx;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+    const char    *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *r);
+    void *user_ctx;
+} httpd_uri_t;
+
+typedef struct httpd_config {
+    unsigned task_priority;
+    size_t   stack_size;
+    uint16_t server_port;
+    uint16_t ctrl_port;
+    uint16_t max_open_sockets;
+    uint16_t max_uri_handlers;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG()     \
+    {                              \
+        .task_priority    = 5,     \
+        .stack_size       = 4096,  \
+        .server_port      = 80,    \
+        .ctrl_port        = 32768, \
+        .max_open_sockets = 7,     \
+        .max_uri_handlers = 8,     \
+    }
+
+/**
+ * @brief Start the server, which accepts connections in its own task.
+ *
+ * @param handle Where to store the server's handle.
+ * @param config The server's configuration.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_register_uri_handler(httpd_handle_t     handle,
+                                     const httpd_uri_t *uri_handler);
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf,
+                                ssize_t buf_len);
+
+#endif /* ESP_HTTP_SERVER_H */
@@ -0,0 +1,59 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+/* Host mock of the ESP-IDF logging library, logging to stderr */
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+/**
+ * @brief Set the maximum level of the messages to log.
+ *
+ * Unlike ESP-IDF, the level applies to all tags.
+ *
+ * @param tag   The tag to set the level for (ignored).
+ * @param level The maximum level to log.
+ */
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+/**
+ * @brief Log a message.
+ *
+ * @param level  The message's level.
+ * @param tag    The tag of the module logging the message.
+ * @param format The message's format string.
+ */
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Log a buffer as hex dump.
+ *
+ * @param tag    The tag of the module logging the buffer.
+ * @param buffer The buffer to log.
+ * @param length The length of the buffer.
+ * @param level  The level to log the buffer at.
+ */
+void esp_log_buffer_hex_internal(const char *tag, const void *buffer,
+                                 size_t length, esp_log_level_t level);
+
+#define ESP_LOGE(tag, ...) esp_log_write(ESP_LOG_ERROR, tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) esp_log_write(ESP_LOG_WARN, tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) esp_log_write(ESP_LOG_INFO, tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) esp_log_write(ESP_LOG_DEBUG, tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) esp_log_write(ESP_LOG_VERBOSE, tag, __VA_ARGS__)
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, length, level) \
+    esp_log_buffer_hex_internal(tag, buffer, length, level)
+
+#endif /* ESP_LOG_H */
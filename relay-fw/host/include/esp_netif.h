@@ -0,0 +1,48 @@
+#ifndef ESP_NETIF_H
+#define ESP_NETIF_H
+
+/* Host mock of the ESP-IDF network interface API, the relay uses the host's
+ * network stack */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr)                                                 \
+    (int)((ipaddr)->addr & 0xff), (int)(((ipaddr)->addr >> 8) & 0xff), \
+        (int)(((ipaddr)->addr >> 16) & 0xff),                          \
+        (int)(((ipaddr)->addr >> 24) & 0xff)
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+    esp_netif_t        *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool                ip_changed;
+} ip_event_got_ip_t;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+} ip_event_t;
+
+extern esp_event_base_t const IP_EVENT;
+
+esp_err_t    esp_netif_init(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
+esp_err_t    esp_netif_set_default_netif(esp_netif_t *esp_netif);
+
+#endif /* ESP_NETIF_H */
@@ -0,0 +1,8 @@
+#ifndef ESP_NETIF_NET_STACK_H
+#define ESP_NETIF_NET_STACK_H
+
+/* Host mock of the ESP-IDF network stack glue, which the host doesn't need */
+
+#include "esp_netif.h"
+
+#endif /* ESP_NETIF_NET_STACK_H */
@@ -0,0 +1,19 @@
+#ifndef ESP_ROM_CRC_H
+#define ESP_ROM_CRC_H
+
+/* Host mock of the ESP ROM CRC functions */
+
+#include <stdint.h>
+
+/**
+ * @brief Compute the CRC-32 (as used by zlib) of a buffer.
+ *
+ * @param crc The CRC of the preceding data, 0 to start.
+ * @param buf The buffer.
+ * @param len The length of the buffer.
+ *
+ * @return uint32_t The CRC of the preceding data and the buffer.
+ */
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
+
+#endif /* ESP_ROM_CRC_H */
@@ -0,0 +1,32 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+/* Host mock of the ESP-IDF system API */
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Restart the relay, which exits the host process.
+ */
+void esp_restart(void) __attribute__((noreturn));
+
+/**
+ * @brief Get the free heap size.
+ *
+ * The host has no fixed heap, so this is the process' free heap as reported
+ * by the C library.
+ *
+ * @return uint32_t The free heap size (in bytes).
+ */
+uint32_t esp_get_free_heap_size(void);
+
+/**
+ * @brief Get the minimum free heap size since starting the relay.
+ *
+ * @return uint32_t The minimum free heap size (in bytes).
+ */
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif /* ESP_SYSTEM_H */
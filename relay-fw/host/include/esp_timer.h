@@ -0,0 +1,15 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+/* Host mock of the ESP-IDF high resolution timer */
+
+#include <stdint.h>
+
+/**
+ * @brief Get the time since starting the relay.
+ *
+ * @return int64_t The time since starting the relay (in us).
+ */
+int64_t esp_timer_get_time(void);
+
+#endif /* ESP_TIMER_H */
@@ -0,0 +1,81 @@
+#ifndef ESP_WIFI_H
+#define ESP_WIFI_H
+
+/* Host mock of the ESP-IDF WiFi driver. The host is always connected, so
+ * connecting to the AP always succeeds right away. */
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+typedef struct {
+    int unused;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() {0}
+
+typedef enum {
+    WIFI_STORAGE_FLASH,
+    WIFI_STORAGE_RAM,
+} wifi_storage_t;
+
+typedef enum {
+    WIFI_MODE_NULL,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+typedef enum {
+    WIFI_IF_STA,
+    WIFI_IF_AP,
+} wifi_interface_t;
+
+typedef enum {
+    WIFI_FAST_SCAN,
+    WIFI_ALL_CHANNEL_SCAN,
+} wifi_scan_method_t;
+
+typedef enum {
+    WIFI_AUTH_OPEN,
+    WIFI_AUTH_WEP,
+    WIFI_AUTH_WPA_PSK,
+    WIFI_AUTH_WPA2_PSK,
+} wifi_auth_mode_t;
+
+typedef struct {
+    int8_t           rssi;
+    wifi_auth_mode_t authmode;
+} wifi_scan_threshold_t;
+
+typedef struct {
+    uint8_t               ssid[32];
+    uint8_t               password[64];
+    wifi_scan_method_t    scan_method;
+    uint8_t               failure_retry_cnt;
+    wifi_scan_threshold_t threshold;
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef enum {
+    WIFI_EVENT_STA_START,
+    WIFI_EVENT_STA_STOP,
+    WIFI_EVENT_STA_CONNECTED,
+    WIFI_EVENT_STA_DISCONNECTED,
+} wifi_event_t;
+
+extern esp_event_base_t const WIFI_EVENT;
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_connect(void);
+
+#endif /* ESP_WIFI_H */
@@ -0,0 +1,43 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+/* Host mock of the FreeRTOS kernel on top of POSIX threads. Ticks are
+ * milliseconds since starting the relay. */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "esp_bit_defs.h"
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY      ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms) \
+    ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE  ((BaseType_t)1)
+#define pdFAIL  pdFALSE
+#define pdPASS  pdTRUE
+
+/* Critical sections only exclude the other tasks entering a critical section
+ * on the same lock, as the host has no interrupts to disable */
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {.mutex = PTHREAD_MUTEX_INITIALIZER}
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)  vPortExitCritical(mux)
+
+#endif /* FREERTOS_H */
@@ -0,0 +1,25 @@
+#ifndef FREERTOS_EVENT_GROUPS_H
+#define FREERTOS_EVENT_GROUPS_H
+
+/* Host mock of FreeRTOS event groups */
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct event_group_t *EventGroupHandle_t;
+typedef uint32_t              EventBits_t;
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t event_group,
+                               const EventBits_t  bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t event_group,
+                                 const EventBits_t  bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t event_group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t event_group,
+                                const EventBits_t  bits,
+                                const BaseType_t   clear_on_exit,
+                                const BaseType_t   wait_for_all,
+                                TickType_t         ticks);
+
+#endif /* FREERTOS_EVENT_GROUPS_H */
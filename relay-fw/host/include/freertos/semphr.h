@@ -0,0 +1,14 @@
+#ifndef FREERTOS_SEMPHR_H
+#define FREERTOS_SEMPHR_H
+
+/* Host mock of FreeRTOS semaphores */
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct semaphore_t *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#endif /* FREERTOS_SEMPHR_H */
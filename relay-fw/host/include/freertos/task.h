@@ -0,0 +1,49 @@
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+/* Host mock of FreeRTOS tasks, every task runs in its own thread */
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct task_t *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/**
+ * @brief Create a task.
+ *
+ * The priority is ignored, all tasks are scheduled by the host.
+ *
+ * @param function    The task function.
+ * @param name        The task's name.
+ * @param stack_depth The task's stack size (in bytes).
+ * @param parameters  The parameter passed to the task function.
+ * @param priority    The task's priority (ignored).
+ * @param created     Where to store the task's handle, may be NULL.
+ *
+ * @return BaseType_t pdPASS if the task was created.
+ */
+BaseType_t xTaskCreate(TaskFunction_t function, const char *const name,
+                       const uint32_t stack_depth, void *const parameters,
+                       UBaseType_t priority, TaskHandle_t *const created);
+
+void       vTaskDelay(const TickType_t ticks);
+void       vTaskDelayUntil(TickType_t *const previous_wake_time,
+                           const TickType_t time_increment);
+TickType_t xTaskGetTickCount(void);
+char      *pcTaskGetName(TaskHandle_t task);
+
+/**
+ * @brief Get the minimum amount of free stack of a task.
+ *
+ * The host doesn't track the stack usage of its threads, so this is always the
+ * task's full stack size.
+ *
+ * @param task The task, NULL for the calling task.
+ *
+ * @return UBaseType_t The minimum amount of free stack (in bytes).
+ */
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+#endif /* FREERTOS_TASK_H */
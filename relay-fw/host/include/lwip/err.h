@@ -0,0 +1,6 @@
+#ifndef LWIP_ERR_H
+#define LWIP_ERR_H
+
+/* Host mock of lwIP, the relay uses the host's network stack */
+
+#endif /* LWIP_ERR_H */
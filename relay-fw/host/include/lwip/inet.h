@@ -0,0 +1,8 @@
+#ifndef LWIP_INET_H
+#define LWIP_INET_H
+
+/* Host mock of lwIP, the relay uses the host's network stack */
+
+#include <arpa/inet.h>
+
+#endif /* LWIP_INET_H */
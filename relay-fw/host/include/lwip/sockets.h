@@ -0,0 +1,8 @@
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+/* Host mock of lwIP, the relay uses the host's network stack */
+
+#include <sys/socket.h>
+
+#endif /* LWIP_SOCKETS_H */
@@ -0,0 +1,6 @@
+#ifndef LWIP_SYS_H
+#define LWIP_SYS_H
+
+/* Host mock of lwIP, the relay uses the host's network stack */
+
+#endif /* LWIP_SYS_H */
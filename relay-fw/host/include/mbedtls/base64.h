@@ -0,0 +1,42 @@
+#ifndef MBEDTLS_BASE64_H
+#define MBEDTLS_BASE64_H
+
+/* Host mock of the Mbed TLS Base64 functions */
+
+#include <stddef.h>
+
+#define MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL  -0x002A
+#define MBEDTLS_ERR_BASE64_INVALID_CHARACTER -0x002C
+
+/**
+ * @brief Encode a buffer into Base64.
+ *
+ * @param dst  The destination buffer, NUL-terminated on success.
+ * @param dlen The size of the destination buffer.
+ * @param olen The number of bytes written (or required, if the destination
+ *             buffer is too small), excluding the NUL terminator.
+ * @param src  The source buffer.
+ * @param slen The length of the source buffer.
+ *
+ * @return int 0 on success, MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL otherwise.
+ */
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen,
+                          const unsigned char *src, size_t slen);
+
+/**
+ * @brief Decode a Base64-encoded buffer.
+ *
+ * @param dst  The destination buffer, may be NULL to query the decoded size.
+ * @param dlen The size of the destination buffer.
+ * @param olen The number of bytes written (or required, if the destination
+ *             buffer is too small).
+ * @param src  The source buffer.
+ * @param slen The length of the source buffer.
+ *
+ * @return int 0 on success, MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL or
+ *             MBEDTLS_ERR_BASE64_INVALID_CHARACTER otherwise.
+ */
+int mbedtls_base64_decode(unsigned char *dst, size_t dlen, size_t *olen,
+                          const unsigned char *src, size_t slen);
+
+#endif /* MBEDTLS_BASE64_H */
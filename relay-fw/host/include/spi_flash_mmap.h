@@ -0,0 +1,8 @@
+#ifndef SPI_FLASH_MMAP_H
+#define SPI_FLASH_MMAP_H
+
+/* Host mock of the SPI flash definitions */
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+#endif /* SPI_FLASH_MMAP_H */
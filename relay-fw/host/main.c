@@ -0,0 +1,117 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "advertiser.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mock.h"
+
+/* Size of the tag store partition, as in partitions.csv */
+#define TAGSTORE_PARTITION_SIZE 0x100000
+
+static const char *const TAG = "HOST";
+
+/* Implemented by the firmware */
+void app_main(void);
+
+/**
+ * @brief Print the usage of the simulated relay.
+ *
+ * @param name The program's name.
+ */
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-d seconds] [-m mac] [-s file] [-q | -v]\n"
+            "  -d seconds  Stop after the given number of seconds\n"
+            "  -m mac      MAC address identifying the relay to the server\n"
+            "  -s file     File backing the tag store partition "
+            "(default: tagstore.bin)\n"
+            "  -q          Only log warnings and errors\n"
+            "  -v          Log debug messages\n",
+            name);
+}
+
+/**
+ * @brief Log a summary of the run, e.g., for benchmarks.
+ */
+static void summary(void) {
+    struct advertiser_stats_t stats = {0};
+
+    advertiser_get_stats(&stats);
+    ESP_LOGW(TAG,
+             "%" PRIu32 " advertisements, %" PRIu32
+             " switch-overs, dead air avg %" PRId64 " us, max %" PRId64 " us",
+             mock_gap_advertisements(), stats.switches,
+             stats.switches > 0 ? stats.dead_air_total_us / stats.switches : 0,
+             stats.dead_air_max_us);
+}
+
+/**
+ * @brief Run the relay firmware as a simulated relay on the host.
+ *
+ * The relay downloads tags from the configured server like on the chip, and
+ * logs the advertisements instead of sending them.
+ */
+int main(int argc, char **argv) {
+    /* Only used with the tag store */
+    __attribute__((unused)) const char *store = "tagstore.bin";
+    long                                duration = 0;
+    int                                 opt      = 0;
+    uint8_t                             mac[6]   = {0};
+
+    while ((opt = getopt(argc, argv, "d:m:s:qv")) != -1) {
+        switch (opt) {
+            case 'd': {
+                duration = strtol(optarg, NULL, 10);
+                break;
+            }
+            case 'm': {
+                if (sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0],
+                           &mac[1], &mac[2], &mac[3], &mac[4], &mac[5])
+                    != 6) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                mock_mac_set(mac);
+                break;
+            }
+            case 's': {
+                store = optarg;
+                break;
+            }
+            case 'q': {
+                esp_log_level_set("*", ESP_LOG_WARN);
+                break;
+            }
+            case 'v': {
+                esp_log_level_set("*", ESP_LOG_DEBUG);
+                break;
+            }
+            default: {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+#if CONFIG_TAGSTORE
+    if (mock_partition_init(store, "tagstore", TAGSTORE_PARTITION_SIZE)
+        != ESP_OK) {
+        ESP_LOGW(TAG, "Running without the tag store partition");
+    }
+#endif /* CONFIG_TAGSTORE */
+    atexit(summary);
+
+    app_main();
+
+    if (duration > 0) {
+        vTaskDelay(duration * 1000 / portTICK_PERIOD_MS);
+        return EXIT_SUCCESS;
+    }
+    for (;;) {
+        vTaskDelay(portMAX_DELAY);
+    }
+}
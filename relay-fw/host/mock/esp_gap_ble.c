@@ -0,0 +1,233 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mock.h"
+
+#define GAP_QUEUE_LEN 32
+
+/* Address and payload the controller holds for an advertising set */
+struct adv_instance_t {
+    esp_bd_addr_t addr;
+    uint8_t       data[ESP_BLE_ADV_DATA_LEN_MAX];
+    uint16_t      data_len;
+};
+
+struct gap_event_t {
+    esp_gap_ble_cb_event_t event;
+    esp_ble_gap_cb_param_t param;
+};
+
+static const char *const TAG = "GAP";
+
+static pthread_mutex_t lock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  posted = PTHREAD_COND_INITIALIZER;
+
+static esp_gap_ble_cb_t      callback                        = NULL;
+static struct gap_event_t    queue[GAP_QUEUE_LEN]            = {0};
+static size_t                queue_head                      = 0;
+static size_t                queue_len                       = 0;
+static struct adv_instance_t instances[EXT_ADV_NUM_SETS_MAX] = {0};
+static atomic_uint_least32_t advertisements                  = 0;
+
+/**
+ * @brief Deliver the completion events of the GAP commands, like the BTC task
+ *        of the Bluedroid stack.
+ *
+ * @param params (unused, required for task function prototype)
+ */
+static void btc_task(void *params) {
+    for (;;) {
+        struct gap_event_t event = {0};
+
+        pthread_mutex_lock(&lock);
+        while (queue_len == 0) {
+            pthread_cond_wait(&posted, &lock);
+        }
+        event      = queue[queue_head];
+        queue_head = (queue_head + 1) % GAP_QUEUE_LEN;
+        queue_len--;
+        pthread_mutex_unlock(&lock);
+
+        if (callback != NULL) {
+            callback(event.event, &event.param);
+        }
+    }
+}
+
+/**
+ * @brief Complete a GAP command.
+ *
+ * @param event The completion event.
+ * @param param The completion event's parameters.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t gap_complete(esp_gap_ble_cb_event_t        event,
+                              const esp_ble_gap_cb_param_t *param) {
+    esp_err_t err = ESP_FAIL;
+
+    pthread_mutex_lock(&lock);
+    if (queue_len < GAP_QUEUE_LEN) {
+        struct gap_event_t *queued =
+            &queue[(queue_head + queue_len) % GAP_QUEUE_LEN];
+        queued->event = event;
+        queued->param = *param;
+        queue_len++;
+        pthread_cond_signal(&posted);
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return err;
+}
+
+/**
+ * @brief Put an advertising set on air.
+ *
+ * @param instance The advertising set.
+ */
+static void gap_advertise(uint8_t instance) {
+    const struct adv_instance_t *adv = &instances[instance];
+
+    atomic_fetch_add(&advertisements, 1);
+    ESP_LOGI(TAG,
+             "Set %u advertising as %02x:%02x:%02x:%02x:%02x:%02x (%u bytes)",
+             instance, adv->addr[0], adv->addr[1], adv->addr[2], adv->addr[3],
+             adv->addr[4], adv->addr[5], adv->data_len);
+    ESP_LOG_BUFFER_HEX_LEVEL(TAG, adv->data, adv->data_len, ESP_LOG_DEBUG);
+}
+
+uint32_t mock_gap_advertisements(void) {
+    return atomic_load(&advertisements);
+}
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init_with_cfg(esp_bluedroid_config_t *cfg) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void) {
+    return xTaskCreate(btc_task, "BTC", 4096, NULL, 19, NULL) == pdPASS
+               ? ESP_OK
+               : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t cb) {
+    callback = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_rand_addr(esp_bd_addr_t rand_addr) {
+    esp_ble_gap_cb_param_t param = {0};
+
+    memcpy(instances[0].addr, rand_addr, sizeof(esp_bd_addr_t));
+    return gap_complete(ESP_GAP_BLE_SET_STATIC_RAND_ADDR_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_config_adv_data_raw(uint8_t *raw_data, uint32_t raw_len) {
+    esp_ble_gap_cb_param_t param = {0};
+
+    if (raw_len > ESP_BLE_ADV_DATA_LEN_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(instances[0].data, raw_data, raw_len);
+    instances[0].data_len = raw_len;
+    return gap_complete(ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params) {
+    esp_ble_gap_cb_param_t param = {0};
+
+    gap_advertise(0);
+    return gap_complete(ESP_GAP_BLE_ADV_START_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_stop_advertising(void) {
+    esp_ble_gap_cb_param_t param = {0};
+
+    return gap_complete(ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_ext_adv_set_params(
+    uint8_t instance, const esp_ble_gap_ext_adv_params_t *params) {
+    esp_ble_gap_cb_param_t param = {.ext_adv_set_params.instance = instance};
+
+    if (instance >= EXT_ADV_NUM_SETS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return gap_complete(ESP_GAP_BLE_EXT_ADV_SET_PARAMS_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_ext_adv_set_rand_addr(uint8_t       instance,
+                                            esp_bd_addr_t rand_addr) {
+    esp_ble_gap_cb_param_t param = {.ext_adv_set_rand_addr.instance =
+                                        instance};
+
+    if (instance >= EXT_ADV_NUM_SETS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(instances[instance].addr, rand_addr, sizeof(esp_bd_addr_t));
+    return gap_complete(ESP_GAP_BLE_EXT_ADV_SET_RAND_ADDR_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_config_ext_adv_data_raw(uint8_t        instance,
+                                              uint16_t       length,
+                                              const uint8_t *data) {
+    esp_ble_gap_cb_param_t param = {.ext_adv_data_set.instance = instance};
+
+    if (instance >= EXT_ADV_NUM_SETS_MAX || length > ESP_BLE_ADV_DATA_LEN_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(instances[instance].data, data, length);
+    instances[instance].data_len = length;
+    return gap_complete(ESP_GAP_BLE_EXT_ADV_DATA_SET_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_ext_adv_start(uint8_t                      num_adv,
+                                    const esp_ble_gap_ext_adv_t *ext_adv) {
+    esp_ble_gap_cb_param_t param = {.ext_adv_start.instance_num = num_adv};
+
+    if (num_adv > EXT_ADV_NUM_SETS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (uint8_t i = 0; i < num_adv; i++) {
+        if (ext_adv[i].instance >= EXT_ADV_NUM_SETS_MAX) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        param.ext_adv_start.instance[i] = ext_adv[i].instance;
+    }
+    for (uint8_t i = 0; i < num_adv; i++) {
+        gap_advertise(ext_adv[i].instance);
+    }
+    return gap_complete(ESP_GAP_BLE_EXT_ADV_START_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_ext_adv_stop(uint8_t        num_adv,
+                                   const uint8_t *ext_adv_inst) {
+    esp_ble_gap_cb_param_t param = {.ext_adv_stop.instance_num = num_adv};
+
+    if (num_adv > EXT_ADV_NUM_SETS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(param.ext_adv_stop.instance, ext_adv_inst, num_adv);
+    return gap_complete(ESP_GAP_BLE_EXT_ADV_STOP_COMPLETE_EVT, &param);
+}
@@ -0,0 +1,559 @@
+#include "esp_http_client.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#define DEFAULT_BUFFER_SIZE 512
+#define DEFAULT_TIMEOUT_MS  5000
+#define MAX_HEADERS         8
+#define RX_SIZE             8192
+#define URL_HOST_LEN        256
+#define URL_PORT_LEN        8
+
+struct header_t {
+    char *key;
+    char *value;
+};
+
+struct esp_http_client {
+    char                    *url;
+    esp_http_client_method_t method;
+    int                      timeout_ms;
+    int                      buffer_size;
+    http_event_handle_cb     event_handler;
+    void                    *user_data;
+    struct header_t          headers[MAX_HEADERS];
+    const char              *post_data;
+    int                      post_len;
+    /* State of the current request */
+    int     fd;
+    int     status_code;
+    int64_t content_length;
+    bool    chunked;
+    bool    complete;
+    /* Received data not processed yet */
+    char   rx[RX_SIZE];
+    size_t rx_start;
+    size_t rx_end;
+};
+
+static const char *const TAG = "HTTP_CLIENT";
+
+/**
+ * @brief Raise an event with the client's event handler.
+ *
+ * @param client   The client.
+ * @param event_id The event.
+ * @param data     The event's data (for data events).
+ * @param data_len The length of the event's data.
+ * @param key      The header's name (for header events).
+ * @param value    The header's value (for header events).
+ */
+static void raise_event(esp_http_client_handle_t   client,
+                        esp_http_client_event_id_t event_id, void *data,
+                        int data_len, char *key, char *value) {
+    esp_http_client_event_t event = {
+        .event_id     = event_id,
+        .client       = client,
+        .data         = data,
+        .data_len     = data_len,
+        .user_data    = client->user_data,
+        .header_key   = key,
+        .header_value = value,
+    };
+
+    if (client->event_handler != NULL) {
+        client->event_handler(&event);
+    }
+}
+
+/**
+ * @brief Split a http:// URL into its host, port, and path.
+ *
+ * @param url  The URL.
+ * @param host Where to store the host.
+ * @param port Where to store the port.
+ * @param path Where to store a pointer to the path (including the query).
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t parse_url(const char *url, char host[URL_HOST_LEN],
+                           char port[URL_PORT_LEN], const char **path) {
+    static const char scheme[] = "http://";
+
+    if (strncmp(url, scheme, sizeof(scheme) - 1) != 0) {
+        return ESP_ERR_HTTP_INVALID_TRANSPORT;
+    }
+    const char *authority = url + sizeof(scheme) - 1;
+    const char *end       = authority + strcspn(authority, "/?");
+    const char *colon     = memchr(authority, ':', end - authority);
+    const char *host_end  = colon != NULL ? colon : end;
+
+    if (host_end == authority || host_end - authority >= URL_HOST_LEN
+        || (colon != NULL && end - colon - 1 >= URL_PORT_LEN)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(host, authority, host_end - authority);
+    host[host_end - authority] = '\0';
+    if (colon != NULL) {
+        memcpy(port, colon + 1, end - colon - 1);
+        port[end - colon - 1] = '\0';
+    } else {
+        strcpy(port, "80");
+    }
+    *path = *end != '\0' ? end : "/";
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Connect to a server.
+ *
+ * @param client The client.
+ * @param host   The server's host.
+ * @param port   The server's port.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t connect_to(esp_http_client_handle_t client, const char *host,
+                            const char *port) {
+    struct addrinfo  hints   = {.ai_socktype = SOCK_STREAM};
+    struct addrinfo *addrs   = NULL;
+    struct timeval   timeout = {
+          .tv_sec  = client->timeout_ms / 1000,
+          .tv_usec = client->timeout_ms % 1000 * 1000,
+    };
+
+    if (getaddrinfo(host, port, &hints, &addrs) != 0) {
+        ESP_LOGE(TAG, "Could not resolve %s", host);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    for (struct addrinfo *addr = addrs; addr != NULL; addr = addr->ai_next) {
+        client->fd =
+            socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (client->fd < 0) {
+            continue;
+        }
+        /* The send timeout also applies to connecting */
+        setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout));
+        setsockopt(client->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                   sizeof(timeout));
+        if (connect(client->fd, addr->ai_addr, addr->ai_addrlen) == 0) {
+            break;
+        }
+        close(client->fd);
+        client->fd = -1;
+    }
+    freeaddrinfo(addrs);
+
+    return client->fd >= 0 ? ESP_OK : ESP_ERR_HTTP_CONNECT;
+}
+
+/**
+ * @brief Send data to the server.
+ *
+ * @param client The client.
+ * @param data   The data.
+ * @param len    The length of the data.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t send_all(esp_http_client_handle_t client, const char *data,
+                          size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(client->fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent <= 0) {
+            return ESP_ERR_HTTP_WRITE_DATA;
+        }
+        data += sent;
+        len -= sent;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Send the request.
+ *
+ * @param client The client.
+ * @param host   The server's host.
+ * @param port   The server's port.
+ * @param path   The request path.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t send_request(esp_http_client_handle_t client, const char *host,
+                              const char *port, const char *path) {
+    static const char *const methods[] = {"GET", "POST", "PUT", "DELETE"};
+    char                     line[URL_HOST_LEN + 64];
+    esp_err_t                err = ESP_OK;
+
+    /* Every request uses a new connection, the server closes it after the
+     * response */
+    snprintf(line, sizeof(line), "%s ", methods[client->method]);
+    err = send_all(client, line, strlen(line));
+    if (err == ESP_OK) {
+        err = send_all(client, path, strlen(path));
+    }
+    if (err == ESP_OK) {
+        snprintf(line, sizeof(line),
+                 " HTTP/1.1\r\nHost: %s:%s\r\n"
+                 "User-Agent: ESP32 HTTP Client/1.0\r\n"
+                 "Connection: close\r\n",
+                 host, port);
+        err = send_all(client, line, strlen(line));
+    }
+    for (size_t i = 0; err == ESP_OK && i < MAX_HEADERS; i++) {
+        if (client->headers[i].key != NULL) {
+            err = send_all(client, client->headers[i].key,
+                           strlen(client->headers[i].key));
+            if (err == ESP_OK) {
+                err = send_all(client, ": ", 2);
+            }
+            if (err == ESP_OK) {
+                err = send_all(client, client->headers[i].value,
+                               strlen(client->headers[i].value));
+            }
+            if (err == ESP_OK) {
+                err = send_all(client, "\r\n", 2);
+            }
+        }
+    }
+    if (err == ESP_OK && client->post_data != NULL) {
+        snprintf(line, sizeof(line), "Content-Length: %d\r\n",
+                 client->post_len);
+        err = send_all(client, line, strlen(line));
+    }
+    if (err == ESP_OK) {
+        err = send_all(client, "\r\n", 2);
+    }
+    if (err == ESP_OK && client->post_data != NULL) {
+        err = send_all(client, client->post_data, client->post_len);
+    }
+
+    return err;
+}
+
+/**
+ * @brief Receive more data from the server.
+ *
+ * @param client The client.
+ *
+ * @return ssize_t The number of bytes received, 0 if the server closed the
+ *                 connection, -1 on errors (including timeouts).
+ */
+static ssize_t receive(esp_http_client_handle_t client) {
+    if (client->rx_start > 0) {
+        /* Make room at the end of the buffer */
+        memmove(client->rx, client->rx + client->rx_start,
+                client->rx_end - client->rx_start);
+        client->rx_end -= client->rx_start;
+        client->rx_start = 0;
+    }
+    if (client->rx_end == sizeof(client->rx)) {
+        return -1;
+    }
+
+    ssize_t received = -1;
+    do {
+        received = recv(client->fd, client->rx + client->rx_end,
+                        sizeof(client->rx) - client->rx_end, 0);
+    } while (received < 0 && errno == EINTR);
+    if (received > 0) {
+        client->rx_end += received;
+    }
+
+    return received;
+}
+
+/**
+ * @brief Receive a line of the response head or of a chunk header.
+ *
+ * @param client The client.
+ *
+ * @return char* The line (without the line break), NULL on errors. The line is
+ *               only valid until receiving more data.
+ */
+static char *receive_line(esp_http_client_handle_t client) {
+    for (;;) {
+        char *start = client->rx + client->rx_start;
+        char *end   = memchr(start, '\n', client->rx_end - client->rx_start);
+        if (end != NULL) {
+            client->rx_start = end + 1 - client->rx;
+            if (end > start && end[-1] == '\r') {
+                end--;
+            }
+            *end = '\0';
+            return start;
+        }
+        if (receive(client) <= 0) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Receive the status line and headers of the response.
+ *
+ * @param client The client.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t receive_head(esp_http_client_handle_t client) {
+    char *line  = receive_line(client);
+    int   minor = 0;
+
+    if (line == NULL
+        || sscanf(line, "HTTP/1.%d %d", &minor, &client->status_code) != 2) {
+        return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    while ((line = receive_line(client)) != NULL && *line != '\0') {
+        char *value = strchr(line, ':');
+        if (value == NULL) {
+            continue;
+        }
+        *value++ = '\0';
+        value += strspn(value, " \t");
+        if (strcasecmp(line, "Content-Length") == 0) {
+            client->content_length = strtoll(value, NULL, 10);
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0
+                   && strcasecmp(value, "chunked") == 0) {
+            client->chunked = true;
+        }
+        raise_event(client, HTTP_EVENT_ON_HEADER, NULL, 0, line, value);
+    }
+
+    return line != NULL ? ESP_OK : ESP_ERR_HTTP_FETCH_HEADER;
+}
+
+/**
+ * @brief Receive a part of the response body and pass it on as data events.
+ *
+ * @param client The client.
+ * @param len    The length of the part, -1 for everything until the server
+ *               closes the connection.
+ *
+ * @return bool true if the whole part was received.
+ */
+static bool receive_body(esp_http_client_handle_t client, int64_t len) {
+    while (len != 0) {
+        size_t available = client->rx_end - client->rx_start;
+        if (available == 0) {
+            ssize_t received = receive(client);
+            if (received == 0 && len < 0) {
+                return true;
+            } else if (received <= 0) {
+                return false;
+            }
+            continue;
+        }
+        size_t n = available;
+        if (n > (size_t)client->buffer_size) {
+            n = client->buffer_size;
+        }
+        if (len >= 0 && n > (uint64_t)len) {
+            n = len;
+        }
+        raise_event(client, HTTP_EVENT_ON_DATA, client->rx + client->rx_start,
+                    n, NULL, NULL);
+        client->rx_start += n;
+        if (len > 0) {
+            len -= n;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Receive a body with chunked transfer encoding.
+ *
+ * @param client The client.
+ *
+ * @return bool true if the whole body was received.
+ */
+static bool receive_chunks(esp_http_client_handle_t client) {
+    for (;;) {
+        char *line = receive_line(client);
+        if (line == NULL) {
+            return false;
+        }
+        int64_t len = strtoll(line, NULL, 16);
+        if (len == 0) {
+            /* Skip the trailers */
+            while ((line = receive_line(client)) != NULL && *line != '\0') {
+            }
+            return line != NULL;
+        }
+        if (len < 0 || !receive_body(client, len)
+            || (line = receive_line(client)) == NULL) {
+            return false;
+        }
+    }
+}
+
+esp_http_client_handle_t esp_http_client_init(
+    const esp_http_client_config_t *config) {
+    struct esp_http_client *client = calloc(1, sizeof(*client));
+
+    if (client == NULL) {
+        return NULL;
+    }
+    client->method        = config->method;
+    client->timeout_ms    = config->timeout_ms > 0 ? config->timeout_ms
+                                                   : DEFAULT_TIMEOUT_MS;
+    client->buffer_size   = config->buffer_size > 0 ? config->buffer_size
+                                                    : DEFAULT_BUFFER_SIZE;
+    client->event_handler = config->event_handler;
+    client->user_data     = config->user_data;
+    client->fd            = -1;
+    if (esp_http_client_set_url(client, config->url) != ESP_OK) {
+        free(client);
+        return NULL;
+    }
+
+    return client;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client) {
+    char        host[URL_HOST_LEN] = {0};
+    char        port[URL_PORT_LEN] = {0};
+    const char *path               = NULL;
+
+    client->status_code    = 0;
+    client->content_length = -1;
+    client->chunked        = false;
+    client->complete       = false;
+    client->rx_start       = 0;
+    client->rx_end         = 0;
+
+    esp_err_t err = parse_url(client->url, host, port, &path);
+    if (err == ESP_OK) {
+        err = connect_to(client, host, port);
+    }
+    if (err == ESP_OK) {
+        raise_event(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+        err = send_request(client, host, port, path);
+    }
+    if (err == ESP_OK) {
+        raise_event(client, HTTP_EVENT_HEADERS_SENT, NULL, 0, NULL, NULL);
+        err = receive_head(client);
+    }
+    if (err == ESP_OK) {
+        if (client->status_code == 204 || client->status_code == 304
+            || client->status_code / 100 == 1) {
+            client->complete = true;
+        } else if (client->chunked) {
+            client->complete = receive_chunks(client);
+        } else {
+            client->complete = receive_body(client, client->content_length);
+        }
+        raise_event(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+    } else {
+        raise_event(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+    }
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+        raise_event(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+    }
+
+    return err;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client,
+                                  const char              *url) {
+    char *copy = strdup(url);
+
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    free(client->url);
+    client->url = copy;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client,
+                                     esp_http_client_method_t method) {
+    client->method = method;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client,
+                                     const char *key, const char *value) {
+    struct header_t *free_header = NULL;
+
+    for (size_t i = 0; i < MAX_HEADERS; i++) {
+        struct header_t *header = &client->headers[i];
+        if (header->key != NULL && strcasecmp(header->key, key) == 0) {
+            char *copy = strdup(value);
+            if (copy == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+            free(header->value);
+            header->value = copy;
+            return ESP_OK;
+        } else if (header->key == NULL && free_header == NULL) {
+            free_header = header;
+        }
+    }
+    if (free_header == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    free_header->key   = strdup(key);
+    free_header->value = strdup(value);
+    if (free_header->key == NULL || free_header->value == NULL) {
+        free(free_header->key);
+        free(free_header->value);
+        *free_header = (struct header_t){0};
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client,
+                                         const char *data, int len) {
+    /* Like ESP-IDF, the data isn't copied */
+    client->post_data = data;
+    client->post_len  = len;
+
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+    return client->status_code;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client) {
+    return client->content_length;
+}
+
+bool esp_http_client_is_complete_data_received(
+    esp_http_client_handle_t client) {
+    return client->complete;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+    for (size_t i = 0; i < MAX_HEADERS; i++) {
+        free(client->headers[i].key);
+        free(client->headers[i].value);
+    }
+    free(client->url);
+    free(client);
+
+    return ESP_OK;
+}
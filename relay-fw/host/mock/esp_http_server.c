@@ -0,0 +1,256 @@
+#include "esp_http_server.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define STR(s)  xSTR(s)
+#define xSTR(s) #s
+
+#define REQUEST_HEAD_LEN 2048
+#define RECV_TIMEOUT_S   5
+
+struct httpd_t {
+    int          fd;
+    size_t       max_uri_handlers;
+    size_t       num_uri_handlers;
+    httpd_uri_t *uri_handlers;
+    portMUX_TYPE lock;
+};
+
+/* State of a response, stored in the request's aux pointer */
+struct response_t {
+    int         fd;
+    const char *type;
+    bool        head_sent;
+    esp_err_t   err;
+};
+
+static const char *const TAG = "HTTPD";
+
+/**
+ * @brief Send data to the client, ignoring that the client went away.
+ *
+ * @param response The response.
+ * @param data     The data.
+ * @param len      The length of the data.
+ */
+static void send_all(struct response_t *response, const char *data,
+                     size_t len) {
+    while (response->err == ESP_OK && len > 0) {
+        ssize_t sent = send(response->fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent <= 0) {
+            response->err = ESP_FAIL;
+        } else {
+            data += sent;
+            len -= sent;
+        }
+    }
+}
+
+/**
+ * @brief Send a response without a body.
+ *
+ * @param response The response.
+ * @param status   The status line's status.
+ */
+static void send_status(struct response_t *response, const char *status) {
+    char head[128];
+
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+             status);
+    send_all(response, head, strlen(head));
+}
+
+/**
+ * @brief Serve a single request on a connection.
+ *
+ * @param server The server.
+ * @param fd     The connection.
+ */
+static void serve(struct httpd_t *server, int fd) {
+    char              head[REQUEST_HEAD_LEN + 1] = {0};
+    size_t            len                        = 0;
+    char              method[8]                  = {0};
+    char              uri[HTTPD_MAX_URI_LEN + 1] = {0};
+    struct response_t response                   = {.fd = fd};
+    httpd_uri_t       handler                    = {0};
+
+    /* Read the request head, the relay's URIs take no request body */
+    while (strstr(head, "\r\n\r\n") == NULL && len < REQUEST_HEAD_LEN) {
+        ssize_t received = recv(fd, head + len, REQUEST_HEAD_LEN - len, 0);
+        if (received <= 0) {
+            return;
+        }
+        len += received;
+    }
+    if (sscanf(head, "%7s %" STR(HTTPD_MAX_URI_LEN) "s", method, uri) != 2) {
+        send_status(&response, "400 Bad Request");
+        return;
+    }
+    /* Handlers match the URI without the query */
+    size_t path_len = strcspn(uri, "?");
+
+    portENTER_CRITICAL(&server->lock);
+    for (size_t i = 0; i < server->num_uri_handlers; i++) {
+        const httpd_uri_t *uri_handler = &server->uri_handlers[i];
+        if (strlen(uri_handler->uri) == path_len
+            && strncmp(uri_handler->uri, uri, path_len) == 0) {
+            handler = *uri_handler;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&server->lock);
+
+    if (handler.handler == NULL) {
+        send_status(&response, "404 Not Found");
+    } else if (strcmp(method, handler.method == HTTP_POST ? "POST" : "GET")
+               != 0) {
+        send_status(&response, "405 Method Not Allowed");
+    } else {
+        httpd_req_t req = {
+            .handle   = server,
+            .method   = handler.method,
+            .uri      = uri,
+            .aux      = &response,
+            .user_ctx = handler.user_ctx,
+        };
+        if (handler.handler(&req) != ESP_OK && !response.head_sent) {
+            send_status(&response, "500 Internal Server Error");
+        }
+    }
+}
+
+/**
+ * @brief Accept and serve connections, one at a time.
+ *
+ * @param params The server.
+ */
+static void httpd_task(void *params) {
+    struct httpd_t *server  = params;
+    struct timeval  timeout = {.tv_sec = RECV_TIMEOUT_S};
+
+    for (;;) {
+        int fd = accept(server->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                ESP_LOGW(TAG, "Could not accept connection: %s",
+                         strerror(errno));
+                vTaskDelay(100 / portTICK_PERIOD_MS);
+            }
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve(server, fd);
+        close(fd);
+    }
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+    struct httpd_t    *server = calloc(1, sizeof(*server));
+    int                reuse  = 1;
+    struct sockaddr_in addr   = {
+          .sin_family      = AF_INET,
+          .sin_port        = htons(config->server_port),
+          .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+
+    if (server == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    server->uri_handlers =
+        calloc(config->max_uri_handlers, sizeof(*server->uri_handlers));
+    server->max_uri_handlers = config->max_uri_handlers;
+    server->lock             = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    server->fd               = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->uri_handlers == NULL || server->fd < 0) {
+        goto fail;
+    }
+    setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(server->fd, config->max_open_sockets) != 0) {
+        ESP_LOGE(TAG, "Could not listen on port %u: %s", config->server_port,
+                 strerror(errno));
+        goto fail;
+    }
+    if (xTaskCreate(httpd_task, "httpd", config->stack_size, server,
+                    config->task_priority, NULL)
+        != pdPASS) {
+        goto fail;
+    }
+    *handle = server;
+
+    return ESP_OK;
+
+fail:
+    if (server->fd >= 0) {
+        close(server->fd);
+    }
+    free(server->uri_handlers);
+    free(server);
+    return ESP_FAIL;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t     handle,
+                                     const httpd_uri_t *uri_handler) {
+    struct httpd_t *server = handle;
+    esp_err_t       err    = ESP_ERR_NO_MEM;
+
+    portENTER_CRITICAL(&server->lock);
+    if (server->num_uri_handlers < server->max_uri_handlers) {
+        server->uri_handlers[server->num_uri_handlers++] = *uri_handler;
+        err                                              = ESP_OK;
+    }
+    portEXIT_CRITICAL(&server->lock);
+
+    return err;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+    struct response_t *response = r->aux;
+
+    response->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf,
+                                ssize_t buf_len) {
+    struct response_t *response = r->aux;
+    char               line[128];
+
+    if (!response->head_sent) {
+        snprintf(line, sizeof(line),
+                 "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+                 "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n",
+                 response->type != NULL ? response->type : "text/html");
+        send_all(response, line, strlen(line));
+        response->head_sent = true;
+    }
+    if (buf != NULL && buf_len < 0) {
+        buf_len = strlen(buf);
+    }
+    if (buf == NULL) {
+        /* Terminate the response */
+        send_all(response, "0\r\n\r\n", 5);
+    } else if (buf_len > 0) {
+        snprintf(line, sizeof(line), "%zx\r\n", (size_t)buf_len);
+        send_all(response, line, strlen(line));
+        send_all(response, buf, buf_len);
+        send_all(response, "\r\n", 2);
+    }
+
+    return response->err;
+}
@@ -0,0 +1,48 @@
+#include "esp_log.h"
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_timer.h"
+
+#define HEX_PER_LINE 16
+
+static atomic_int max_level = ESP_LOG_INFO;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    atomic_store(&max_level, level);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) {
+    static const char letters[] = "NEWIDV";
+    va_list           args;
+
+    if (level > atomic_load(&max_level)) {
+        return;
+    }
+    flockfile(stderr);
+    fprintf(stderr, "%c (%lld) %s: ", letters[level],
+            (long long)(esp_timer_get_time() / 1000), tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    funlockfile(stderr);
+}
+
+void esp_log_buffer_hex_internal(const char *tag, const void *buffer,
+                                 size_t length, esp_log_level_t level) {
+    const uint8_t *bytes                      = buffer;
+    char           line[3 * HEX_PER_LINE + 1] = {0};
+
+    for (size_t i = 0; i < length; i += HEX_PER_LINE) {
+        size_t len = 0;
+        for (size_t j = i; j < length && j < i + HEX_PER_LINE; j++) {
+            len += snprintf(line + len, sizeof(line) - len, "%02x ", bytes[j]);
+        }
+        esp_log_write(level, tag, "%s", line);
+    }
+}
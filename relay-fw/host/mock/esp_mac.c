@@ -0,0 +1,29 @@
+#include "esp_mac.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mock.h"
+
+/* Locally administered address, set up on first use unless set explicitly */
+static uint8_t base_mac[6] = {0};
+static bool    mac_set     = false;
+
+void mock_mac_set(const uint8_t mac[6]) {
+    memcpy(base_mac, mac, sizeof(base_mac));
+    mac_set = true;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+    if (!mac_set) {
+        /* Tell simulated relays running side by side apart */
+        pid_t   pid        = getpid();
+        uint8_t pid_mac[6] = {0x02,      0x00,     pid >> 24,
+                              pid >> 16, pid >> 8, pid};
+        mock_mac_set(pid_mac);
+    }
+    memcpy(mac, base_mac, sizeof(base_mac));
+
+    return ESP_OK;
+}
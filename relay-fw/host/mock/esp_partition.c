@@ -0,0 +1,156 @@
+#include "esp_partition.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "mock.h"
+#include "spi_flash_mmap.h"
+
+static const char *const TAG = "PARTITION";
+
+/* The single data partition and the file contents backing it */
+static esp_partition_t data_partition = {0};
+static uint8_t        *flash          = NULL;
+
+/**
+ * @brief Check whether a range lies within the partition.
+ *
+ * @param offset The offset of the range.
+ * @param size   The size of the range.
+ *
+ * @return bool true if the range lies within the partition.
+ */
+static bool in_partition(size_t offset, size_t size) {
+    return offset <= data_partition.size
+           && size <= data_partition.size - offset;
+}
+
+esp_err_t mock_partition_init(const char *path, const char *label,
+                              size_t size) {
+    struct stat st = {0};
+
+    if (size == 0 || size % SPI_FLASH_SEC_SIZE != 0
+        || strlen(label) >= sizeof(data_partition.label)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        ESP_LOGE(TAG, "Could not open %s", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return ESP_FAIL;
+    }
+    bool fresh = (size_t)st.st_size != size;
+    if (fresh && ftruncate(fd, size) != 0) {
+        ESP_LOGE(TAG, "Could not resize %s", path);
+        close(fd);
+        return ESP_FAIL;
+    }
+    flash = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (flash == MAP_FAILED) {
+        ESP_LOGE(TAG, "Could not map %s", path);
+        flash = NULL;
+        return ESP_FAIL;
+    }
+    if (fresh) {
+        /* Start out with erased flash */
+        memset(flash, 0xff, size);
+    }
+
+    data_partition.type       = ESP_PARTITION_TYPE_DATA;
+    data_partition.subtype    = ESP_PARTITION_SUBTYPE_ANY;
+    data_partition.size       = size;
+    data_partition.erase_size = SPI_FLASH_SEC_SIZE;
+    strcpy(data_partition.label, label);
+    ESP_LOGI(TAG, "Partition \"%s\" backed by %s (%zu bytes)", label, path,
+             size);
+
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t    type,
+                                                esp_partition_subtype_t subtype,
+                                                const char             *label) {
+    if (flash == NULL || type != data_partition.type
+        || (subtype != ESP_PARTITION_SUBTYPE_ANY
+            && subtype != data_partition.subtype)
+        || (label != NULL && strcmp(label, data_partition.label) != 0)) {
+        return NULL;
+    }
+
+    return &data_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size) {
+    if (!in_partition(src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, flash + src_offset, size);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src, size_t size) {
+    const uint8_t *bytes = src;
+
+    if (!in_partition(dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    /* Like NOR flash, writing can only clear bits, setting them takes an
+     * erase */
+    for (size_t i = 0; i < size; i++) {
+        flash[dst_offset + i] &= bytes[i];
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size) {
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!in_partition(offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(flash + offset, 0xff, size);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t      *partition,
+                             size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory,
+                             const void                **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle) {
+    if (!in_partition(offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    /* Mapped reads see later writes, like the flash cache after writing */
+    *out_ptr    = flash + offset;
+    *out_handle = 0;
+
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
@@ -0,0 +1,80 @@
+#include "esp_system.h"
+
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+
+static const char *const TAG = "SYSTEM";
+
+static atomic_uint_least32_t min_free_heap = UINT32_MAX;
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_FAIL:
+            return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:
+            return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:
+            return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:
+            return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:
+            return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_CRC:
+            return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_HTTP_CONNECT:
+            return "ESP_ERR_HTTP_CONNECT";
+        case ESP_ERR_HTTP_WRITE_DATA:
+            return "ESP_ERR_HTTP_WRITE_DATA";
+        case ESP_ERR_HTTP_FETCH_HEADER:
+            return "ESP_ERR_HTTP_FETCH_HEADER";
+        case ESP_ERR_HTTP_INVALID_TRANSPORT:
+            return "ESP_ERR_HTTP_INVALID_TRANSPORT";
+        default:
+            return "UNKNOWN ERROR";
+    }
+}
+
+void _esp_error_check_failed(esp_err_t code, const char *file, int line,
+                             const char *expression) {
+    ESP_LOGE(TAG, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d: %s",
+             code, esp_err_to_name(code), file, line, expression);
+    abort();
+}
+
+void esp_restart(void) {
+    ESP_LOGW(TAG, "Restart requested, exiting");
+    exit(EXIT_FAILURE);
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    struct mallinfo2 info      = mallinfo2();
+    uint32_t         free_heap = MIN(info.fordblks, UINT32_MAX);
+    uint_least32_t   min       = atomic_load(&min_free_heap);
+
+    /* Only sampled on request, unlike on the chip */
+    while (free_heap < min
+           && !atomic_compare_exchange_weak(&min_free_heap, &min, free_heap)) {
+    }
+
+    return free_heap;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    esp_get_free_heap_size();
+    return atomic_load(&min_free_heap);
+}
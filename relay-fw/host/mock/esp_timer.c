@@ -0,0 +1,49 @@
+#include "esp_timer.h"
+
+#include <time.h>
+
+#include "mock.h"
+
+/* Monotonic time of starting the relay */
+static struct timespec start = {0};
+
+/**
+ * @brief Take the time of starting the relay.
+ */
+__attribute__((constructor)) static void esp_timer_start(void) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+/**
+ * @brief Get the time since starting the relay.
+ *
+ * @return int64_t The time since starting the relay (in us).
+ */
+int64_t esp_timer_get_time(void) {
+    struct timespec now = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - start.tv_sec) * 1000000
+           + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+/**
+ * @brief Convert a time since starting the relay to an absolute time.
+ *
+ * @param us The time since starting the relay (in us).
+ *
+ * @return struct timespec The absolute time on the monotonic clock, e.g., to
+ *                         sleep or wait until.
+ */
+struct timespec mock_time_abs(int64_t us) {
+    struct timespec abs = start;
+
+    abs.tv_sec += us / 1000000;
+    abs.tv_nsec += (us % 1000000) * 1000;
+    if (abs.tv_nsec >= 1000000000) {
+        abs.tv_sec++;
+        abs.tv_nsec -= 1000000000;
+    }
+
+    return abs;
+}
@@ -0,0 +1,181 @@
+#include "esp_wifi.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define EVENT_HANDLERS  8
+#define EVENT_QUEUE_LEN 16
+#define EVENT_DATA_SIZE 64
+
+struct event_handler_t {
+    esp_event_base_t    base;
+    int32_t             id;
+    esp_event_handler_t handler;
+    void               *arg;
+};
+
+struct event_t {
+    esp_event_base_t base;
+    int32_t          id;
+    uint8_t          data[EVENT_DATA_SIZE];
+};
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT   = "IP_EVENT";
+
+static const char *const TAG = "WIFI";
+
+static pthread_mutex_t lock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  posted = PTHREAD_COND_INITIALIZER;
+
+static struct event_handler_t handlers[EVENT_HANDLERS] = {0};
+static size_t                 num_handlers             = 0;
+static struct event_t         queue[EVENT_QUEUE_LEN]   = {0};
+static size_t                 queue_head               = 0;
+static size_t                 queue_len                = 0;
+static bool                   started                  = false;
+
+/**
+ * @brief Run the handlers of the posted events, like the default event loop.
+ *
+ * @param params (unused, required for task function prototype)
+ */
+static void event_task(void *params) {
+    for (;;) {
+        struct event_t         event = {0};
+        struct event_handler_t matching[EVENT_HANDLERS];
+        size_t                 num_matching = 0;
+
+        pthread_mutex_lock(&lock);
+        while (queue_len == 0) {
+            pthread_cond_wait(&posted, &lock);
+        }
+        event      = queue[queue_head];
+        queue_head = (queue_head + 1) % EVENT_QUEUE_LEN;
+        queue_len--;
+        for (size_t i = 0; i < num_handlers; i++) {
+            if (handlers[i].base == event.base
+                && (handlers[i].id == ESP_EVENT_ANY_ID
+                    || handlers[i].id == event.id)) {
+                matching[num_matching++] = handlers[i];
+            }
+        }
+        pthread_mutex_unlock(&lock);
+
+        for (size_t i = 0; i < num_matching; i++) {
+            matching[i].handler(matching[i].arg, event.base, event.id,
+                                event.data);
+        }
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+    if (started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    started = xTaskCreate(event_task, "sys_evt", 4096, NULL, 20, NULL)
+              == pdPASS;
+
+    return started ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_event_handler_instance_register(
+    esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void *event_handler_arg,
+    esp_event_handler_instance_t *instance) {
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    pthread_mutex_lock(&lock);
+    if (num_handlers < EVENT_HANDLERS) {
+        handlers[num_handlers] = (struct event_handler_t){
+            event_base, event_id, event_handler, event_handler_arg};
+        if (instance != NULL) {
+            *instance = &handlers[num_handlers];
+        }
+        num_handlers++;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return err;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id,
+                         const void *event_data, size_t event_data_size,
+                         TickType_t ticks_to_wait) {
+    esp_err_t err = ESP_ERR_TIMEOUT;
+
+    if (event_data_size > EVENT_DATA_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    if (queue_len < EVENT_QUEUE_LEN) {
+        struct event_t *event =
+            &queue[(queue_head + queue_len) % EVENT_QUEUE_LEN];
+        event->base = event_base;
+        event->id   = event_id;
+        memcpy(event->data, event_data, event_data_size);
+        queue_len++;
+        pthread_cond_signal(&posted);
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return err;
+}
+
+esp_err_t esp_netif_init(void) {
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void) {
+    /* Only used as an opaque handle */
+    static int netif = 0;
+
+    return (esp_netif_t *)&netif;
+}
+
+esp_err_t esp_netif_set_default_netif(esp_netif_t *esp_netif) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf) {
+    ESP_LOGI(TAG, "Station configured for SSID %s", conf->sta.ssid);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, 0);
+}
+
+esp_err_t esp_wifi_connect(void) {
+    /* The host is always connected, report the loopback address */
+    ip_event_got_ip_t event = {
+        .esp_netif  = esp_netif_create_default_wifi_sta(),
+        .ip_info.ip = {.addr = htonl(INADDR_LOOPBACK)},
+        .ip_changed = true,
+    };
+
+    return esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event),
+                          0);
+}
@@ -0,0 +1,273 @@
+/* For pthread_setname_np */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mock.h"
+
+#define TASK_NAME_LEN 16
+
+struct task_t {
+    pthread_t      thread;
+    TaskFunction_t function;
+    void          *parameters;
+    uint32_t       stack_depth;
+    char           name[TASK_NAME_LEN];
+};
+
+/* Binary semaphores and event groups both wait for a condition on a value */
+struct semaphore_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            given;
+};
+
+struct event_group_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    EventBits_t     bits;
+};
+
+/* The task app_main runs in, i.e., the host's main thread */
+static struct task_t main_task = {.name = "main", .stack_depth = 8192};
+
+static _Thread_local struct task_t *current_task = &main_task;
+
+/**
+ * @brief Initialize a condition variable that waits on the monotonic clock.
+ *
+ * @param cond The condition variable.
+ */
+static void cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * @brief Wait on a condition variable for up to a number of ticks.
+ *
+ * @param cond     The condition variable.
+ * @param mutex    The locked mutex associated with the condition variable.
+ * @param deadline The time to wait until (in us since starting the relay), -1
+ *                 to wait forever.
+ *
+ * @return bool false if the deadline passed.
+ */
+static bool cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                      int64_t deadline) {
+    if (deadline < 0) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+
+    struct timespec abs = mock_time_abs(deadline);
+    return pthread_cond_timedwait(cond, mutex, &abs) != ETIMEDOUT;
+}
+
+/**
+ * @brief Get the deadline of waiting a number of ticks.
+ *
+ * @param ticks The number of ticks to wait, portMAX_DELAY to wait forever.
+ *
+ * @return int64_t The deadline (in us since starting the relay), -1 for none.
+ */
+static int64_t deadline_in(TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return -1;
+    }
+
+    return esp_timer_get_time() + (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+/**
+ * @brief Run a task in its thread.
+ *
+ * @param arg The task.
+ *
+ * @return void* Always NULL, tasks don't return.
+ */
+static void *task_run(void *arg) {
+    current_task = arg;
+    current_task->function(current_task->parameters);
+
+    return NULL;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+    pthread_mutex_lock(&mux->mutex);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+    pthread_mutex_unlock(&mux->mutex);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *const name,
+                       const uint32_t stack_depth, void *const parameters,
+                       UBaseType_t priority, TaskHandle_t *const created) {
+    struct task_t *task = calloc(1, sizeof(*task));
+
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->function    = function;
+    task->parameters  = parameters;
+    task->stack_depth = stack_depth;
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    if (pthread_create(&task->thread, NULL, task_run, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_setname_np(task->thread, task->name);
+    if (created != NULL) {
+        *created = task;
+    }
+
+    return pdPASS;
+}
+
+void vTaskDelay(const TickType_t ticks) {
+    struct timespec abs = mock_time_abs(
+        esp_timer_get_time() + (int64_t)ticks * portTICK_PERIOD_MS * 1000);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &abs, NULL)
+           == EINTR) {
+    }
+}
+
+void vTaskDelayUntil(TickType_t *const previous_wake_time,
+                     const TickType_t time_increment) {
+    *previous_wake_time += time_increment;
+    struct timespec abs =
+        mock_time_abs((int64_t)*previous_wake_time * portTICK_PERIOD_MS * 1000);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &abs, NULL)
+           == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return esp_timer_get_time() / 1000 / portTICK_PERIOD_MS;
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+    return task != NULL ? task->name : current_task->name;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return task != NULL ? task->stack_depth : current_task->stack_depth;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    struct semaphore_t *semaphore = calloc(1, sizeof(*semaphore));
+
+    if (semaphore != NULL) {
+        pthread_mutex_init(&semaphore->mutex, NULL);
+        cond_init(&semaphore->cond);
+    }
+
+    return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    int64_t deadline = deadline_in(ticks);
+
+    pthread_mutex_lock(&semaphore->mutex);
+    while (!semaphore->given
+           && cond_wait(&semaphore->cond, &semaphore->mutex, deadline)) {
+    }
+    bool taken       = semaphore->given;
+    semaphore->given = false;
+    pthread_mutex_unlock(&semaphore->mutex);
+
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    pthread_mutex_lock(&semaphore->mutex);
+    bool given       = !semaphore->given;
+    semaphore->given = true;
+    pthread_cond_signal(&semaphore->cond);
+    pthread_mutex_unlock(&semaphore->mutex);
+
+    return given ? pdTRUE : pdFALSE;
+}
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    struct event_group_t *event_group = calloc(1, sizeof(*event_group));
+
+    if (event_group != NULL) {
+        pthread_mutex_init(&event_group->mutex, NULL);
+        cond_init(&event_group->cond);
+    }
+
+    return event_group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t event_group,
+                               const EventBits_t  bits) {
+    pthread_mutex_lock(&event_group->mutex);
+    event_group->bits |= bits;
+    EventBits_t set = event_group->bits;
+    pthread_cond_broadcast(&event_group->cond);
+    pthread_mutex_unlock(&event_group->mutex);
+
+    return set;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t event_group,
+                                 const EventBits_t  bits) {
+    pthread_mutex_lock(&event_group->mutex);
+    EventBits_t set = event_group->bits;
+    event_group->bits &= ~bits;
+    pthread_mutex_unlock(&event_group->mutex);
+
+    return set;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t event_group) {
+    pthread_mutex_lock(&event_group->mutex);
+    EventBits_t set = event_group->bits;
+    pthread_mutex_unlock(&event_group->mutex);
+
+    return set;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t event_group,
+                                const EventBits_t  bits,
+                                const BaseType_t   clear_on_exit,
+                                const BaseType_t   wait_for_all,
+                                TickType_t         ticks) {
+    int64_t deadline = deadline_in(ticks);
+    bool    done     = false;
+
+    pthread_mutex_lock(&event_group->mutex);
+    for (;;) {
+        EventBits_t set = event_group->bits & bits;
+        done            = wait_for_all ? set == bits : set != 0;
+        if (done
+            || !cond_wait(&event_group->cond, &event_group->mutex, deadline)) {
+            break;
+        }
+    }
+    EventBits_t set = event_group->bits;
+    if (done && clear_on_exit) {
+        event_group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&event_group->mutex);
+
+    return set;
+}
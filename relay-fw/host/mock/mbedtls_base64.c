@@ -0,0 +1,113 @@
+#include "mbedtls/base64.h"
+
+#include <stdint.h>
+
+static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * @brief Decode a single Base64 character.
+ *
+ * @param c The character.
+ *
+ * @return int The character's 6-bit value, -1 if it's invalid.
+ */
+static int decode_char(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    } else if (c == '+') {
+        return 62;
+    } else if (c == '/') {
+        return 63;
+    }
+
+    return -1;
+}
+
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen,
+                          const unsigned char *src, size_t slen) {
+    size_t n = (slen + 2) / 3 * 4;
+
+    *olen = n + 1;
+    if (dst == NULL || dlen < n + 1) {
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+    for (size_t i = 0, j = 0; i < slen; i += 3) {
+        uint32_t block = (uint32_t)src[i] << 16;
+        if (i + 1 < slen) {
+            block |= (uint32_t)src[i + 1] << 8;
+        }
+        if (i + 2 < slen) {
+            block |= src[i + 2];
+        }
+        dst[j++] = alphabet[(block >> 18) & 0x3f];
+        dst[j++] = alphabet[(block >> 12) & 0x3f];
+        dst[j++] = i + 1 < slen ? alphabet[(block >> 6) & 0x3f] : '=';
+        dst[j++] = i + 2 < slen ? alphabet[block & 0x3f] : '=';
+    }
+    dst[n] = '\0';
+    *olen  = n;
+
+    return 0;
+}
+
+int mbedtls_base64_decode(unsigned char *dst, size_t dlen, size_t *olen,
+                          const unsigned char *src, size_t slen) {
+    size_t   n       = 0;
+    size_t   padding = 0;
+    uint32_t block   = 0;
+    size_t   chars   = 0;
+
+    /* Validate the input and compute the decoded size first, like Mbed TLS */
+    for (size_t i = 0; i < slen; i++) {
+        if (src[i] == ' ' || src[i] == '\r' || src[i] == '\n') {
+            continue;
+        } else if (src[i] == '=') {
+            if (++padding > 2) {
+                return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+            }
+        } else if (padding > 0 || decode_char(src[i]) < 0) {
+            return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+        }
+        chars++;
+    }
+    if (chars % 4 != 0) {
+        return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+    }
+    n = chars / 4 * 3 - padding;
+    if (dst == NULL || dlen < n) {
+        *olen = n;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+
+    chars   = 0;
+    padding = 0;
+    n       = 0;
+    for (size_t i = 0; i < slen; i++) {
+        if (src[i] == ' ' || src[i] == '\r' || src[i] == '\n') {
+            continue;
+        } else if (src[i] == '=') {
+            padding++;
+            block <<= 6;
+        } else {
+            block = (block << 6) | decode_char(src[i]);
+        }
+        if (++chars % 4 == 0) {
+            /* Padding drops the trailing bytes of the last block */
+            dst[n++] = block >> 16;
+            if (padding < 2) {
+                dst[n++] = block >> 8;
+            }
+            if (padding < 1) {
+                dst[n++] = block;
+            }
+        }
+    }
+    *olen = n;
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef MOCK_H
+#define MOCK_H
+
+/* Host-only functions of the mocked ESP-IDF, which have no ESP-IDF
+ * equivalent */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Convert a time since starting the relay to an absolute time.
+ *
+ * @param us The time since starting the relay (in us).
+ *
+ * @return struct timespec The absolute time on the monotonic clock, e.g., to
+ *                         sleep or wait until.
+ */
+struct timespec mock_time_abs(int64_t us);
+
+/**
+ * @brief Back the data partition by a file.
+ *
+ * The file is created (erased) if it doesn't exist yet. Must be called before
+ * any of the partition functions.
+ *
+ * @param path  The path of the file.
+ * @param label The label of the partition.
+ * @param size  The size of the partition (in bytes), a multiple of the flash
+ *              sector size.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t mock_partition_init(const char *path, const char *label,
+                              size_t size);
+
+/**
+ * @brief Set the relay's MAC address.
+ *
+ * Defaults to a locally administered address derived from the process ID.
+ *
+ * @param mac The MAC address.
+ */
+void mock_mac_set(const uint8_t mac[6]);
+
+/**
+ * @brief Get the number of advertisements the mocked BLE controller started.
+ *
+ * @return uint32_t The number of advertisements started.
+ */
+uint32_t mock_gap_advertisements(void);
+
+#endif /* MOCK_H */
@@ -0,0 +1,107 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+/* Configuration of the host build, the equivalent of the sdkconfig.h that
+ * ESP-IDF generates from the Kconfig options. The defaults match the firmware
+ * defaults, every option can be overridden with a compile definition (see
+ * CMakeLists.txt). Disabled boolean options are defined as 0. */
+
+/* WiFi configuration (unused, the host is always connected) */
+#ifndef CONFIG_ESP_WIFI_SSID
+#define CONFIG_ESP_WIFI_SSID "ssid"
+#endif
+#ifndef CONFIG_ESP_WIFI_PASSWD
+#define CONFIG_ESP_WIFI_PASSWD "password"
+#endif
+#ifndef CONFIG_ESP_WIFI_RETRIES
+#define CONFIG_ESP_WIFI_RETRIES 5
+#endif
+
+/* HTTP client configuration */
+#ifndef CONFIG_HTTP_BUFFER_SIZE
+#define CONFIG_HTTP_BUFFER_SIZE 512
+#endif
+#ifndef CONFIG_RELAY_ENDPOINT_HOST
+#define CONFIG_RELAY_ENDPOINT_HOST "127.0.0.1"
+#endif
+#ifndef CONFIG_RELAY_ENDPOINT_PORT
+#define CONFIG_RELAY_ENDPOINT_PORT 8000
+#endif
+#ifndef CONFIG_NUM_TAGS
+#define CONFIG_NUM_TAGS 5
+#endif
+#ifndef CONFIG_VALID_TAGS_ONLY
+#define CONFIG_VALID_TAGS_ONLY 1
+#endif
+#ifndef CONFIG_ROTATE_TAGS
+#define CONFIG_ROTATE_TAGS 0
+#endif
+#ifndef CONFIG_DELTA_SYNC
+#define CONFIG_DELTA_SYNC (CONFIG_VALID_TAGS_ONLY && !CONFIG_ROTATE_TAGS)
+#endif
+#ifndef CONFIG_LONG_POLL
+#define CONFIG_LONG_POLL CONFIG_DELTA_SYNC
+#endif
+#ifndef CONFIG_LONG_POLL_TIMEOUT
+#define CONFIG_LONG_POLL_TIMEOUT 30
+#endif
+#ifndef CONFIG_BINARY_FEED
+#define CONFIG_BINARY_FEED 1
+#endif
+#ifndef CONFIG_RELAY_DOWNLOAD_INTERVAL
+#define CONFIG_RELAY_DOWNLOAD_INTERVAL 10000
+#endif
+#ifndef CONFIG_ADAPTIVE_POLL
+#define CONFIG_ADAPTIVE_POLL (!CONFIG_ROTATE_TAGS)
+#endif
+#ifndef CONFIG_ADAPTIVE_POLL_MAX_INTERVAL
+#define CONFIG_ADAPTIVE_POLL_MAX_INTERVAL 900000
+#endif
+
+/* BLE advertiser configuration */
+#ifndef CONFIG_BLE_ADVERTISEMENT_INTERVAL
+#define CONFIG_BLE_ADVERTISEMENT_INTERVAL 500
+#endif
+#ifndef CONFIG_BLE_ADVERTISEMENT_DURATION
+#define CONFIG_BLE_ADVERTISEMENT_DURATION 2000
+#endif
+#ifndef CONFIG_BLE_MULTI_ADV
+#define CONFIG_BLE_MULTI_ADV 0
+#endif
+#ifndef CONFIG_BLE_ADV_SETS
+#define CONFIG_BLE_ADV_SETS 4
+#endif
+#if !defined(CONFIG_TAGSCHED_WEIGHTED_FAIR) \
+    && !defined(CONFIG_TAGSCHED_EARLIEST_EXPIRY)
+#define CONFIG_TAGSCHED_ROUND_ROBIN 1
+#endif
+
+/* Tag store configuration */
+#ifndef CONFIG_TAGSTORE
+#define CONFIG_TAGSTORE (!CONFIG_ROTATE_TAGS)
+#endif
+#ifndef CONFIG_TAGSTORE_MAX_TAGS
+#define CONFIG_TAGSTORE_MAX_TAGS 1024
+#endif
+
+/* Coverage report configuration */
+#ifndef CONFIG_COVERAGE_REPORT
+#define CONFIG_COVERAGE_REPORT 1
+#endif
+#ifndef CONFIG_COVERAGE_REPORT_INTERVAL
+#define CONFIG_COVERAGE_REPORT_INTERVAL 300
+#endif
+#ifndef CONFIG_COVERAGE_REPORT_TAGS
+#define CONFIG_COVERAGE_REPORT_TAGS \
+    (CONFIG_TAGSTORE ? CONFIG_TAGSTORE_MAX_TAGS : CONFIG_NUM_TAGS)
+#endif
+
+/* Metrics configuration */
+#ifndef CONFIG_METRICS
+#define CONFIG_METRICS 1
+#endif
+#ifndef CONFIG_METRICS_PORT
+#define CONFIG_METRICS_PORT 8080
+#endif
+
+#endif /* SDKCONFIG_H */
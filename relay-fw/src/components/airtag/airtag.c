@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include "esp_log.h"
 #include "mbedtls/base64.h"
@@ -50,8 +51,8 @@ success_e airtag_to_key(struct airtag_t *airtag, uint8_t key[KEY_LEN]) {
         return FAILURE;
     }
 
-    ESP_LOGI(TAG, "Decoded %zd bytes of AirTag payload:", written);
-    ESP_LOG_BUFFER_HEX_LEVEL(TAG, bin_data, BIN_DATA_LEN, ESP_LOG_INFO);
+    ESP_LOGD(TAG, "Decoded %zd bytes of AirTag payload:", written);
+    ESP_LOG_BUFFER_HEX_LEVEL(TAG, bin_data, BIN_DATA_LEN, ESP_LOG_DEBUG);
 
     key[0] = ((bin_data[35] << 6) & 0b11000000) | (bin_data[5] & 0b00111111);
     for (size_t i = 1; i < 6; i++) {
@@ -128,3 +129,18 @@ success_e airtag_to_ble_advertisement(struct airtag_t *airtag,
     /* Extracted data successfully */
     return res;
 }
+
+/**
+ * @brief Convert an AirTag's stored data into a pre-decoded BLE advertisement.
+ *
+ * @param airtag Pointer to an AirTag struct.
+ * @param adv    Pointer to the advertisement struct to fill.
+ *
+ * @return success_e An enum value indicating successful or failed conversion.
+ */
+success_e airtag_to_adv(struct airtag_t *airtag, struct airtag_adv_t *adv) {
+    adv->id       = airtag->id;
+    adv->valid_to = airtag->valid_to;
+    adv->weight   = MIN(MAX(airtag->weight, 1), UINT16_MAX);
+    return airtag_to_ble_advertisement(airtag, adv->addr, adv->payload);
+}
@@ -25,6 +25,20 @@ struct airtag_t {
     uint32_t id;
     char     data[DATA_LEN];
     bool     valid;
+    uint32_t valid_to;
+    uint32_t weight;
+};
+
+/* Pre-decoded BLE advertisement of an AirTag, i.e., everything the advertiser
+ * needs without having to decode the base64 data again (plus the AirTag's ID
+ * to identify it when applying changes, and its expiry as epoch seconds or 0
+ * if unknown and relative share of air time for scheduling) */
+struct airtag_adv_t {
+    uint32_t id;
+    uint8_t  addr[ADDR_LEN];
+    uint8_t  payload[PAYLOAD_LEN];
+    uint32_t valid_to;
+    uint16_t weight;
 };
 
 /**
@@ -60,4 +74,14 @@ success_e airtag_to_ble_advertisement(struct airtag_t *airtag,
                                       uint8_t          ble_adv_addr[ADDR_LEN],
                                       uint8_t ble_adv_body[PAYLOAD_LEN]);
 
+/**
+ * @brief Convert an AirTag's stored data into a pre-decoded BLE advertisement.
+ *
+ * @param airtag Pointer to an AirTag struct.
+ * @param adv    Pointer to the advertisement struct to fill.
+ *
+ * @return success_e An enum value indicating successful or failed conversion.
+ */
+success_e airtag_to_adv(struct airtag_t *airtag, struct airtag_adv_t *adv);
+
 #endif /* AIRTAG_H */
@@ -0,0 +1,121 @@
+#include "jsonstream.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *const TAG = "JSONSTREAM";
+
+/* Nesting depth of the objects we hand out: the top-level array is at depth 1,
+ * so its elements start at depth 2 */
+#define OBJECT_DEPTH 2
+
+/**
+ * @brief Initialize (or reset) a streaming splitter.
+ *
+ * @param stream      Pointer to the splitter state.
+ * @param buffer      Buffer to collect a single object in.
+ * @param buffer_size Size of the buffer, objects (including the terminating
+ *                    NUL) that do not fit are dropped.
+ * @param callback    Function to call for each complete object.
+ * @param arg         User argument passed on to the callback.
+ */
+void jsonstream_init(struct jsonstream_t *stream, char *buffer,
+                     size_t buffer_size, jsonstream_cb_t callback, void *arg) {
+    memset(stream, 0, sizeof(*stream));
+    stream->buffer      = buffer;
+    stream->buffer_size = buffer_size;
+    stream->callback    = callback;
+    stream->arg         = arg;
+}
+
+/**
+ * @brief Append a character to the object currently being collected.
+ *
+ * @param stream Pointer to the splitter state.
+ * @param c      The character to append.
+ */
+static void append(struct jsonstream_t *stream, char c) {
+    if (stream->overflow) {
+        return;
+    }
+    if (stream->len + 1 >= stream->buffer_size) {
+        /* Object (plus terminating NUL) exceeds the buffer, drop it */
+        stream->overflow = true;
+        return;
+    }
+    stream->buffer[stream->len++] = c;
+}
+
+/**
+ * @brief Feed the next chunk of the JSON document into the splitter.
+ *
+ * Invokes the callback for every object completed within the chunk.
+ *
+ * @param stream Pointer to the splitter state.
+ * @param data   Chunk of JSON text (not necessarily NUL-terminated).
+ * @param len    Length of the chunk.
+ */
+void jsonstream_feed(struct jsonstream_t *stream, const char *data,
+                     size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (stream->depth >= OBJECT_DEPTH) {
+            append(stream, c);
+        }
+
+        /* Structural characters inside of strings don't count */
+        if (stream->in_string) {
+            if (stream->escaped) {
+                stream->escaped = false;
+            } else if (c == '\\') {
+                stream->escaped = true;
+            } else if (c == '"') {
+                stream->in_string = false;
+            }
+            continue;
+        }
+
+        switch (c) {
+            case '"': {
+                stream->in_string = true;
+                break;
+            }
+            case '[':
+                __attribute__((fallthrough));
+            case '{': {
+                stream->depth++;
+                if (stream->depth == OBJECT_DEPTH) {
+                    /* Start of a new element of the top-level array */
+                    stream->len      = 0;
+                    stream->overflow = false;
+                    append(stream, c);
+                }
+                break;
+            }
+            case ']':
+                __attribute__((fallthrough));
+            case '}': {
+                if (stream->depth == OBJECT_DEPTH) {
+                    /* End of an element of the top-level array */
+                    if (stream->overflow) {
+                        ESP_LOGW(TAG, "Object exceeds %zu bytes, dropping",
+                                 stream->buffer_size);
+                        stream->dropped++;
+                    } else if (c == '}') {
+                        stream->buffer[stream->len] = '\0';
+                        stream->callback(stream->buffer, stream->arg);
+                    }
+                }
+                if (stream->depth > 0) {
+                    stream->depth--;
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef JSONSTREAM_H
+#define JSONSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Callback invoked for every complete object of the streamed array.
+ *
+ * @param object NUL-terminated JSON text of the object (including braces).
+ * @param arg    User argument given to jsonstream_init().
+ */
+typedef void (*jsonstream_cb_t)(const char *object, void *arg);
+
+/* State of a streaming splitter for a top-level JSON array of objects. The
+ * array may arrive in arbitrary chunks, only a single object is buffered at a
+ * time. */
+struct jsonstream_t {
+    char           *buffer;
+    size_t          buffer_size;
+    size_t          len;
+    int             depth;
+    bool            in_string;
+    bool            escaped;
+    bool            overflow;
+    unsigned int    dropped;
+    jsonstream_cb_t callback;
+    void           *arg;
+};
+
+/**
+ * @brief Initialize (or reset) a streaming splitter.
+ *
+ * @param stream      Pointer to the splitter state.
+ * @param buffer      Buffer to collect a single object in.
+ * @param buffer_size Size of the buffer, objects (including the terminating
+ *                    NUL) that do not fit are dropped.
+ * @param callback    Function to call for each complete object.
+ * @param arg         User argument passed on to the callback.
+ */
+void jsonstream_init(struct jsonstream_t *stream, char *buffer,
+                     size_t buffer_size, jsonstream_cb_t callback, void *arg);
+
+/**
+ * @brief Feed the next chunk of the JSON document into the splitter.
+ *
+ * Invokes the callback for every object completed within the chunk.
+ *
+ * @param stream Pointer to the splitter state.
+ * @param data   Chunk of JSON text (not necessarily NUL-terminated).
+ * @param len    Length of the chunk.
+ */
+void jsonstream_feed(struct jsonstream_t *stream, const char *data,
+                     size_t len);
+
+#endif /* JSONSTREAM_H */
@@ -0,0 +1,295 @@
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_system.h"
+
+#define METRICS_LINE_LEN 160
+
+struct metrics_info_t {
+    const char *name;
+    const char *help;
+};
+
+struct histogram_t {
+    uint32_t buckets[METRICS_BUCKETS];
+    uint32_t count;
+    uint64_t sum;
+};
+
+static const char *const TAG = "METRICS";
+
+static const struct metrics_info_t counter_info[METRICS_COUNTERS] = {
+    [METRIC_FETCHES]       = {"relay_fetches_total", "Tag downloads started"},
+    [METRIC_FETCH_ERRORS]  = {"relay_fetch_errors_total",
+                              "Tag downloads that failed"},
+    [METRIC_FETCH_BYTES]   = {"relay_fetch_bytes_total",
+                              "Bytes of tag downloads received"},
+    [METRIC_TAGS_SKIPPED]  = {"relay_tags_skipped_total",
+                              "Tags skipped as their advertisement couldn't be "
+                              "extracted"},
+    [METRIC_TAGS_DROPPED]  = {"relay_tags_dropped_total",
+                              "Tags dropped as the tag table was full"},
+    [METRIC_GAP_ERRORS]    = {"relay_gap_errors_total",
+                              "GAP commands that failed"},
+    [METRIC_REPORTS]       = {"relay_reports_total", "Coverage reports sent"},
+    [METRIC_REPORT_ERRORS] = {"relay_report_errors_total",
+                              "Coverage reports that failed"},
+};
+
+static const struct metrics_info_t gauge_info[METRICS_GAUGES] = {
+    [METRIC_TAGS_HELD] = {"relay_tags_held", "Tags currently advertised"},
+};
+
+static const struct metrics_info_t histogram_info[METRICS_HISTOGRAMS] = {
+    [METRIC_FETCH_LATENCY] = {"relay_fetch_latency_us",
+                              "Duration of tag downloads, including long-poll "
+                              "waits (in us)"},
+    [METRIC_PARSE_TIME]    = {"relay_parse_time_us",
+                              "Time to parse and decode a JSON tag (in us)"},
+    [METRIC_GAP_LATENCY]   = {"relay_gap_latency_us",
+                              "Time until GAP commands complete (in us)"},
+    [METRIC_DEAD_AIR]      = {"relay_dead_air_us",
+                              "Time without advertisement when switching tags "
+                              "(in us)"},
+};
+
+static uint32_t           counters[METRICS_COUNTERS]     = {0};
+static int32_t            gauges[METRICS_GAUGES]         = {0};
+static struct histogram_t histograms[METRICS_HISTOGRAMS] = {0};
+static TaskHandle_t       tasks[METRICS_MAX_TASKS]       = {0};
+static portMUX_TYPE       lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Increase a counter.
+ *
+ * May be called from any task.
+ *
+ * @param counter The counter to increase.
+ * @param n       The amount to increase the counter by.
+ */
+void metrics_count(metrics_counter_e counter, uint32_t n) {
+    portENTER_CRITICAL(&lock);
+    counters[counter] += n;
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Set a gauge.
+ *
+ * May be called from any task.
+ *
+ * @param gauge The gauge to set.
+ * @param value The gauge's new value.
+ */
+void metrics_set(metrics_gauge_e gauge, int32_t value) {
+    portENTER_CRITICAL(&lock);
+    gauges[gauge] = value;
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Record a value in a histogram.
+ *
+ * May be called from any task.
+ *
+ * @param histogram The histogram to record the value in.
+ * @param value     The value (in us).
+ */
+void metrics_observe(metrics_histogram_e histogram, int64_t value) {
+    uint32_t clamped = value < 0 ? 0 : value > UINT32_MAX ? UINT32_MAX : value;
+    /* Smallest i with value <= 2^i */
+    unsigned int bucket = clamped <= 1 ? 0 : 32 - __builtin_clz(clamped - 1);
+
+    portENTER_CRITICAL(&lock);
+    if (bucket < METRICS_BUCKETS) {
+        histograms[histogram].buckets[bucket]++;
+    }
+    histograms[histogram].count++;
+    histograms[histogram].sum += clamped;
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Track the stack usage of a task.
+ *
+ * @param task Handle of the task.
+ */
+void metrics_track_task(TaskHandle_t task) {
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < METRICS_MAX_TASKS; i++) {
+        if (tasks[i] == NULL) {
+            tasks[i] = task;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Send a line of the metrics response.
+ *
+ * @param req    Pointer to the request.
+ * @param format printf-style format string of the line.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t send_line(httpd_req_t *req, const char *format, ...) {
+    char    line[METRICS_LINE_LEN] = {0};
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0 || (size_t)len >= sizeof(line)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return httpd_resp_send_chunk(req, line, len);
+}
+
+/**
+ * @brief Send the header lines of a metric.
+ *
+ * @param req  Pointer to the request.
+ * @param info Pointer to the metric's name and description.
+ * @param type Prometheus type of the metric.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t send_header(httpd_req_t                 *req,
+                             const struct metrics_info_t *info,
+                             const char                  *type) {
+    esp_err_t err = send_line(req, "# HELP %s %s\n", info->name, info->help);
+
+    return err == ESP_OK ? send_line(req, "# TYPE %s %s\n", info->name, type)
+                         : err;
+}
+
+/**
+ * @brief Handle requests for the metrics.
+ *
+ * @param req Pointer to the request.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t metrics_handler(httpd_req_t *req) {
+    static const struct metrics_info_t heap_info = {
+        "relay_free_heap_bytes", "Free heap (in bytes)"};
+    static const struct metrics_info_t min_heap_info = {
+        "relay_min_free_heap_bytes", "Lowest free heap since boot (in bytes)"};
+    static const struct metrics_info_t stack_info = {
+        "relay_stack_free_bytes",
+        "Lowest free stack of a task since it started (in bytes)"};
+    uint32_t           counter   = 0;
+    int32_t            gauge     = 0;
+    struct histogram_t histogram = {0};
+    esp_err_t          err       = ESP_OK;
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+    for (size_t i = 0; err == ESP_OK && i < METRICS_COUNTERS; i++) {
+        portENTER_CRITICAL(&lock);
+        counter = counters[i];
+        portEXIT_CRITICAL(&lock);
+        err = send_header(req, &counter_info[i], "counter");
+        if (err == ESP_OK) {
+            err = send_line(req, "%s %" PRIu32 "\n", counter_info[i].name,
+                            counter);
+        }
+    }
+    for (size_t i = 0; err == ESP_OK && i < METRICS_GAUGES; i++) {
+        portENTER_CRITICAL(&lock);
+        gauge = gauges[i];
+        portEXIT_CRITICAL(&lock);
+        err = send_header(req, &gauge_info[i], "gauge");
+        if (err == ESP_OK) {
+            err = send_line(req, "%s %" PRId32 "\n", gauge_info[i].name, gauge);
+        }
+    }
+    for (size_t i = 0; err == ESP_OK && i < METRICS_HISTOGRAMS; i++) {
+        const char *name       = histogram_info[i].name;
+        uint32_t    cumulative = 0;
+
+        portENTER_CRITICAL(&lock);
+        histogram = histograms[i];
+        portEXIT_CRITICAL(&lock);
+        err = send_header(req, &histogram_info[i], "histogram");
+        for (size_t b = 0; err == ESP_OK && b < METRICS_BUCKETS; b++) {
+            cumulative += histogram.buckets[b];
+            err = send_line(req, "%s_bucket{le=\"%" PRIu32 "\"} %" PRIu32 "\n",
+                            name, (uint32_t)1 << b, cumulative);
+        }
+        if (err == ESP_OK) {
+            err = send_line(req,
+                            "%s_bucket{le=\"+Inf\"} %" PRIu32 "\n"
+                            "%s_sum %" PRIu64 "\n%s_count %" PRIu32 "\n",
+                            name, histogram.count, name, histogram.sum, name,
+                            histogram.count);
+        }
+    }
+
+    /* Resource usage is sampled on request */
+    if (err == ESP_OK) {
+        err = send_header(req, &heap_info, "gauge");
+    }
+    if (err == ESP_OK) {
+        err = send_line(req, "%s %" PRIu32 "\n", heap_info.name,
+                        esp_get_free_heap_size());
+    }
+    if (err == ESP_OK) {
+        err = send_header(req, &min_heap_info, "gauge");
+    }
+    if (err == ESP_OK) {
+        err = send_line(req, "%s %" PRIu32 "\n", min_heap_info.name,
+                        esp_get_minimum_free_heap_size());
+    }
+    if (err == ESP_OK) {
+        err = send_header(req, &stack_info, "gauge");
+    }
+    for (size_t i = 0; err == ESP_OK && i < METRICS_MAX_TASKS; i++) {
+        if (tasks[i] != NULL) {
+            err = send_line(req, "%s{task=\"%s\"} %u\n", stack_info.name,
+                            pcTaskGetName(tasks[i]),
+                            uxTaskGetStackHighWaterMark(tasks[i]));
+        }
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Could not send metrics: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    /* Terminate the chunked response */
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/**
+ * @brief Serve the metrics at /metrics in the Prometheus text format.
+ *
+ * @param port TCP port to listen on.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t metrics_server_start(uint16_t port) {
+    static const httpd_uri_t uri    = {.uri     = "/metrics",
+                                       .method  = HTTP_GET,
+                                       .handler = metrics_handler};
+    httpd_handle_t           server = NULL;
+    httpd_config_t           config = HTTPD_DEFAULT_CONFIG();
+
+    config.server_port = port;
+    esp_err_t err      = httpd_start(&server, &config);
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(server, &uri);
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Serving metrics on port %u", port);
+    }
+
+    return err;
+}
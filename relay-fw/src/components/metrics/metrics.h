@@ -0,0 +1,87 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* Histograms have power-of-two buckets, i.e., bucket i counts the values of at
+ * most 2^i (us), the largest bucket is for values of up to about 16 s */
+#define METRICS_BUCKETS 25
+/* Maximum number of tasks whose stack usage is tracked */
+#define METRICS_MAX_TASKS 4
+
+typedef enum {
+    METRIC_FETCHES,
+    METRIC_FETCH_ERRORS,
+    METRIC_FETCH_BYTES,
+    METRIC_TAGS_SKIPPED,
+    METRIC_TAGS_DROPPED,
+    METRIC_GAP_ERRORS,
+    METRIC_REPORTS,
+    METRIC_REPORT_ERRORS,
+    METRICS_COUNTERS,
+} metrics_counter_e;
+
+typedef enum {
+    METRIC_TAGS_HELD,
+    METRICS_GAUGES,
+} metrics_gauge_e;
+
+typedef enum {
+    METRIC_FETCH_LATENCY,
+    METRIC_PARSE_TIME,
+    METRIC_GAP_LATENCY,
+    METRIC_DEAD_AIR,
+    METRICS_HISTOGRAMS,
+} metrics_histogram_e;
+
+/**
+ * @brief Increase a counter.
+ *
+ * May be called from any task.
+ *
+ * @param counter The counter to increase.
+ * @param n       The amount to increase the counter by.
+ */
+void metrics_count(metrics_counter_e counter, uint32_t n);
+
+/**
+ * @brief Set a gauge.
+ *
+ * May be called from any task.
+ *
+ * @param gauge The gauge to set.
+ * @param value The gauge's new value.
+ */
+void metrics_set(metrics_gauge_e gauge, int32_t value);
+
+/**
+ * @brief Record a value in a histogram.
+ *
+ * May be called from any task.
+ *
+ * @param histogram The histogram to record the value in.
+ * @param value     The value (in us).
+ */
+void metrics_observe(metrics_histogram_e histogram, int64_t value);
+
+/**
+ * @brief Track the stack usage of a task.
+ *
+ * @param task Handle of the task.
+ */
+void metrics_track_task(TaskHandle_t task);
+
+/**
+ * @brief Serve the metrics at /metrics in the Prometheus text format.
+ *
+ * @param port TCP port to listen on.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t metrics_server_start(uint16_t port);
+
+#endif /* METRICS_H */
@@ -0,0 +1,144 @@
+#include "tagfeed.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+
+static const char *const TAG = "TAGFEED";
+
+/**
+ * @brief Read a little endian 16 bit value.
+ *
+ * @param data Pointer to the first byte of the value.
+ * @return uint16_t The value.
+ */
+static uint16_t read_le16(const uint8_t *data) {
+    return (uint16_t)data[0] | ((uint16_t)data[1] << 8);
+}
+
+/**
+ * @brief Read a little endian 32 bit value.
+ *
+ * @param data Pointer to the first byte of the value.
+ * @return uint32_t The value.
+ */
+static uint32_t read_le32(const uint8_t *data) {
+    return (uint32_t)read_le16(data) | ((uint32_t)read_le16(data + 2) << 16);
+}
+
+/**
+ * @brief Initialize (or reset) a streaming feed decoder.
+ *
+ * @param feed     Pointer to the decoder state.
+ * @param callback Function to call for each complete record.
+ * @param arg      User argument passed on to the callback.
+ */
+void tagfeed_init(struct tagfeed_t *feed, tagfeed_cb_t callback, void *arg) {
+    memset(feed, 0, sizeof(*feed));
+    feed->header_len = TAGFEED_HEADER_LEN;
+    feed->callback   = callback;
+    feed->arg        = arg;
+}
+
+/**
+ * @brief Parse the buffered feed header.
+ *
+ * @param feed Pointer to the decoder state.
+ */
+static void parse_header(struct tagfeed_t *feed) {
+    const uint8_t *header = feed->buffer;
+
+    if (memcmp(header, TAGFEED_MAGIC, TAGFEED_MAGIC_LEN) != 0) {
+        ESP_LOGE(TAG, "Invalid feed magic");
+        feed->error = true;
+        return;
+    }
+    if (header[4] != TAGFEED_VERSION && header[4] != TAGFEED_LARGE_VERSION) {
+        ESP_LOGE(TAG, "Unsupported feed version %u", header[4]);
+        feed->error = true;
+        return;
+    }
+    if (header[5] < TAGFEED_RECORD_LEN) {
+        ESP_LOGE(TAG, "Invalid feed record size %u", header[5]);
+        feed->error = true;
+        return;
+    }
+    if (header[4] == TAGFEED_LARGE_VERSION
+        && feed->header_len < TAGFEED_LARGE_HEADER_LEN) {
+        /* Keep what we have and collect the rest of the longer header */
+        feed->len        = feed->header_len;
+        feed->header_len = TAGFEED_LARGE_HEADER_LEN;
+        return;
+    }
+    feed->record_len  = header[5];
+    feed->remaining   = header[4] == TAGFEED_LARGE_VERSION
+                            ? read_le32(&header[8])
+                            : read_le16(&header[6]);
+    feed->header_done = true;
+    ESP_LOGD(TAG, "Feed announces %u records", feed->remaining);
+}
+
+/**
+ * @brief Decode the buffered record and hand it to the callback.
+ *
+ * @param feed Pointer to the decoder state.
+ */
+static void parse_record(struct tagfeed_t *feed) {
+    struct tagfeed_record_t record = {0};
+    const uint8_t          *data   = feed->buffer;
+
+    record.adv.id = read_le32(data);
+    data += 4;
+    memcpy(record.adv.addr, data, ADDR_LEN);
+    data += ADDR_LEN;
+    memcpy(record.adv.payload, data, PAYLOAD_LEN);
+    data += PAYLOAD_LEN;
+    record.adv.valid_to = read_le32(data);
+    data += 4;
+    /* The weight was only added later, default to an equal share */
+    record.adv.weight = feed->record_len >= TAGFEED_WEIGHTED_RECORD_LEN
+                            ? MAX(read_le16(data), 1)
+                            : 1;
+
+    feed->remaining--;
+    feed->callback(&record, feed->arg);
+}
+
+/**
+ * @brief Feed the next chunk of the binary tag feed into the decoder.
+ *
+ * Invokes the callback for every record completed within the chunk. Once the
+ * decoder encounters an invalid header, it ignores all further data.
+ *
+ * @param feed Pointer to the decoder state.
+ * @param data Chunk of the binary feed.
+ * @param len  Length of the chunk.
+ */
+void tagfeed_feed(struct tagfeed_t *feed, const uint8_t *data, size_t len) {
+    while (len > 0 && !feed->error) {
+        if (feed->header_done && feed->remaining == 0) {
+            ESP_LOGW(TAG, "Ignoring %zu trailing bytes", len);
+            return;
+        }
+
+        /* Collect the header or the next record */
+        size_t wanted = feed->header_done ? feed->record_len : feed->header_len;
+        size_t copy_len = MIN(len, wanted - feed->len);
+        memcpy(feed->buffer + feed->len, data, copy_len);
+        feed->len += copy_len;
+        data += copy_len;
+        len -= copy_len;
+
+        if (feed->len < wanted) {
+            /* Need more data */
+            return;
+        }
+        feed->len = 0;
+        if (feed->header_done) {
+            parse_record(feed);
+        } else {
+            parse_header(feed);
+        }
+    }
+}
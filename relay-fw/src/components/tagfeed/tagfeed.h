@@ -0,0 +1,85 @@
+#ifndef TAGFEED_H
+#define TAGFEED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "airtag.h"
+
+/* The binary tag feed consists of a header followed by fixed-size records, all
+ * little endian:
+ *
+ *   header: magic "PSTF" (4) | version (1) | record size (1) | count (2)
+ *   record: id (4) | address (6) | payload (31) | valid_to (4) | weight (2)
+ *
+ * Feeds of more than 65535 records come with a version 2 header instead, which
+ * widens the count:
+ *
+ *   header: magic "PSTF" (4) | version (1) | record size (1) | reserved (2) |
+ *           count (4)
+ *
+ * Records may grow in later versions of the same format, so the decoder only
+ * relies on the record size given in the header and ignores trailing bytes.
+ * The weight is optional, feeds with shorter records give all tags weight 1. */
+#define TAGFEED_MAGIC               "PSTF"
+#define TAGFEED_MAGIC_LEN           4
+#define TAGFEED_VERSION             1
+#define TAGFEED_HEADER_LEN          8
+#define TAGFEED_LARGE_VERSION       2
+#define TAGFEED_LARGE_HEADER_LEN    12
+#define TAGFEED_RECORD_LEN          (4 + ADDR_LEN + PAYLOAD_LEN + 4)
+#define TAGFEED_WEIGHTED_RECORD_LEN (TAGFEED_RECORD_LEN + 2)
+#define TAGFEED_MAX_RECORD          UINT8_MAX
+#define TAGFEED_CONTENT_TYPE        "application/octet-stream"
+
+/* A single decoded record of the binary tag feed, a valid_to of 0 denotes a
+ * tag that is not valid (anymore) */
+struct tagfeed_record_t {
+    struct airtag_adv_t adv;
+};
+
+/**
+ * @brief Callback invoked for every complete record of the feed.
+ *
+ * @param record Pointer to the decoded record.
+ * @param arg    User argument given to tagfeed_init().
+ */
+typedef void (*tagfeed_cb_t)(const struct tagfeed_record_t *record, void *arg);
+
+/* State of a streaming decoder for the binary tag feed. The feed may arrive in
+ * arbitrary chunks, only a single record is buffered at a time. */
+struct tagfeed_t {
+    uint8_t      buffer[TAGFEED_MAX_RECORD];
+    size_t       len;
+    size_t       header_len;
+    bool         header_done;
+    bool         error;
+    uint8_t      record_len;
+    unsigned int remaining;
+    tagfeed_cb_t callback;
+    void        *arg;
+};
+
+/**
+ * @brief Initialize (or reset) a streaming feed decoder.
+ *
+ * @param feed     Pointer to the decoder state.
+ * @param callback Function to call for each complete record.
+ * @param arg      User argument passed on to the callback.
+ */
+void tagfeed_init(struct tagfeed_t *feed, tagfeed_cb_t callback, void *arg);
+
+/**
+ * @brief Feed the next chunk of the binary tag feed into the decoder.
+ *
+ * Invokes the callback for every record completed within the chunk. Once the
+ * decoder encounters an invalid header, it ignores all further data.
+ *
+ * @param feed Pointer to the decoder state.
+ * @param data Chunk of the binary feed.
+ * @param len  Length of the chunk.
+ */
+void tagfeed_feed(struct tagfeed_t *feed, const uint8_t *data, size_t len);
+
+#endif /* TAGFEED_H */
@@ -0,0 +1,134 @@
+#include "tagreport.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+/* The component is only used with coverage reports enabled */
+#if CONFIG_COVERAGE_REPORT
+
+/* Size of the hash tables counting the slots, kept at most half full */
+#define TAGREPORT_SLOTS (2 * TAGREPORT_MAX_TAGS)
+
+/* Slots counted for a tag, entries without slots are free */
+struct entry_t {
+    uint32_t id;
+    uint16_t slots;
+};
+
+/* Tags are counted in one table while the other one is encoded, so the
+ * advertiser never waits for the encoding */
+struct report_t {
+    struct entry_t entries[TAGREPORT_SLOTS];
+    size_t         count;
+    size_t         dropped;
+};
+
+static const char *const TAG = "TAGREPORT";
+
+static struct report_t  reports[2]  = {0};
+static struct report_t *current     = &reports[0];
+static portMUX_TYPE     report_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Write an unsigned integer in little endian.
+ *
+ * @param buf   Buffer to write to.
+ * @param value The value to write.
+ * @param len   Number of bytes to write.
+ */
+static void put_le(uint8_t *buf, uint32_t value, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+/**
+ * @brief Count a slot in which a tag was on air.
+ *
+ * Tags beyond the first TAGREPORT_MAX_TAGS of a report are not counted. May be
+ * called from any task.
+ *
+ * @param id ID of the tag.
+ */
+void tagreport_record(uint32_t id) {
+    /* Fibonacci hashing spreads the mostly consecutive IDs */
+    size_t i = (id * 2654435761u) % TAGREPORT_SLOTS;
+
+    portENTER_CRITICAL(&report_lock);
+    struct entry_t *entries = current->entries;
+    while (entries[i].slots > 0 && entries[i].id != id) {
+        i = (i + 1) % TAGREPORT_SLOTS;
+    }
+    if (entries[i].slots == 0 && current->count == TAGREPORT_MAX_TAGS) {
+        current->dropped++;
+    } else {
+        if (entries[i].slots == 0) {
+            entries[i].id = id;
+            current->count++;
+        }
+        if (entries[i].slots < UINT16_MAX) {
+            entries[i].slots++;
+        }
+    }
+    portEXIT_CRITICAL(&report_lock);
+}
+
+/**
+ * @brief Encode the report of the slots counted so far and start a new one.
+ *
+ * Must only be called by a single task.
+ *
+ * @param buf     Buffer to encode the report into, which should hold
+ *                TAGREPORT_MAX_LEN bytes.
+ * @param len     Length of the buffer, tags that don't fit are left out.
+ * @param slot_ms Duration (in ms) of a slot.
+ *
+ * @return size_t Length of the encoded report.
+ */
+size_t tagreport_take(uint8_t *buf, size_t len, uint32_t slot_ms) {
+    struct report_t *report = NULL;
+    size_t           count  = 0;
+    size_t           pos    = TAGREPORT_HEADER_LEN;
+
+    if (len < TAGREPORT_HEADER_LEN) {
+        return 0;
+    }
+
+    /* Only this function switches the tables, so nobody else touches the
+     * previous one once it's switched */
+    portENTER_CRITICAL(&report_lock);
+    report  = current;
+    current = report == &reports[0] ? &reports[1] : &reports[0];
+    portEXIT_CRITICAL(&report_lock);
+
+    for (size_t i = 0; i < TAGREPORT_SLOTS; i++) {
+        if (report->entries[i].slots == 0) {
+            continue;
+        }
+        if (pos + TAGREPORT_RECORD_LEN > len) {
+            report->dropped++;
+            continue;
+        }
+        put_le(&buf[pos], report->entries[i].id, 4);
+        put_le(&buf[pos + 4], report->entries[i].slots, 2);
+        pos += TAGREPORT_RECORD_LEN;
+        count++;
+    }
+    if (report->dropped > 0) {
+        ESP_LOGW(TAG, "Left %zu tags out of the report", report->dropped);
+    }
+
+    memcpy(buf, TAGREPORT_MAGIC, TAGREPORT_MAGIC_LEN);
+    buf[4] = TAGREPORT_VERSION;
+    buf[5] = TAGREPORT_RECORD_LEN;
+    put_le(&buf[6], count, 2);
+    put_le(&buf[8], slot_ms, 4);
+
+    memset(report, 0, sizeof(*report));
+
+    return pos;
+}
+
+#endif /* CONFIG_COVERAGE_REPORT */
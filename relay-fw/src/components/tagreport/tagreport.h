@@ -0,0 +1,57 @@
+#ifndef TAGREPORT_H
+#define TAGREPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/* Coverage reports tell the server how much air time every tag got from the
+ * relay since the last report. A report consists of a header followed by
+ * fixed-size records, all little endian:
+ *
+ *   header: magic "PSCR" (4) | version (1) | record size (1) | count (2) |
+ *           slot duration in ms (4)
+ *   record: id (4) | slots (2)
+ *
+ * A slot is one advertisement duration during which the tag was on air. */
+#define TAGREPORT_MAGIC        "PSCR"
+#define TAGREPORT_MAGIC_LEN    4
+#define TAGREPORT_VERSION      1
+#define TAGREPORT_HEADER_LEN   12
+#define TAGREPORT_RECORD_LEN   6
+#define TAGREPORT_CONTENT_TYPE "application/octet-stream"
+#if CONFIG_COVERAGE_REPORT
+#define TAGREPORT_MAX_TAGS CONFIG_COVERAGE_REPORT_TAGS
+#else
+#define TAGREPORT_MAX_TAGS 0
+#endif /* CONFIG_COVERAGE_REPORT */
+/* Maximum length of a report */
+#define TAGREPORT_MAX_LEN \
+    (TAGREPORT_HEADER_LEN + TAGREPORT_MAX_TAGS * TAGREPORT_RECORD_LEN)
+
+/**
+ * @brief Count a slot in which a tag was on air.
+ *
+ * Tags beyond the first TAGREPORT_MAX_TAGS of a report are not counted. May be
+ * called from any task.
+ *
+ * @param id ID of the tag.
+ */
+void tagreport_record(uint32_t id);
+
+/**
+ * @brief Encode the report of the slots counted so far and start a new one.
+ *
+ * Must only be called by a single task.
+ *
+ * @param buf     Buffer to encode the report into, which should hold
+ *                TAGREPORT_MAX_LEN bytes.
+ * @param len     Length of the buffer, tags that don't fit are left out.
+ * @param slot_ms Duration (in ms) of a slot.
+ *
+ * @return size_t Length of the encoded report.
+ */
+size_t tagreport_take(uint8_t *buf, size_t len, uint32_t slot_ms);
+
+#endif /* TAGREPORT_H */
@@ -0,0 +1,294 @@
+#include "tagsched.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+#include "tagtable.h"
+
+#if CONFIG_TAGSCHED_WEIGHTED_FAIR
+#define TAGSCHED_DEFAULT_POLICY TAGSCHED_WEIGHTED_FAIR
+#elif CONFIG_TAGSCHED_EARLIEST_EXPIRY
+#define TAGSCHED_DEFAULT_POLICY TAGSCHED_EARLIEST_EXPIRY
+#else
+#define TAGSCHED_DEFAULT_POLICY TAGSCHED_ROUND_ROBIN
+#endif /* CONFIG_TAGSCHED_WEIGHTED_FAIR */
+
+/* The published table may be a view of more tags than fit into RAM tables */
+#if CONFIG_TAGSTORE
+#define TAGSCHED_SIZE MAX(TAGTABLE_SIZE, CONFIG_TAGSTORE_MAX_TAGS)
+#else
+#define TAGSCHED_SIZE TAGTABLE_SIZE
+#endif /* CONFIG_TAGSTORE */
+
+/* Virtual time a tag of weight 1 is charged per advertisement with weighted
+ * fair scheduling */
+#define TAGSCHED_WEIGHT_SCALE 65536
+
+/* A tag in the priority queue. The tag with the lowest key (and ID to break
+ * ties) is advertised next. */
+struct entry_t {
+    uint64_t key;
+    uint32_t id;
+    uint32_t slot;
+};
+
+static const char *const TAG = "TAGSCHED";
+
+static const char *const policy_names[] = {
+    [TAGSCHED_ROUND_ROBIN]     = "round-robin",
+    [TAGSCHED_WEIGHTED_FAIR]   = "weighted-fair",
+    [TAGSCHED_EARLIEST_EXPIRY] = "earliest-expiry",
+};
+
+static _Atomic tagsched_policy_e requested_policy = TAGSCHED_DEFAULT_POLICY;
+
+/* The following state is only accessed by the reader of the tag table */
+static tagsched_policy_e current_policy = TAGSCHED_DEFAULT_POLICY;
+/* Binary min-heap of the tags, plus room for rebuilding it */
+static struct entry_t  heaps[2][TAGSCHED_SIZE] = {0};
+static struct entry_t *heap                    = heaps[0];
+static size_t          heap_len                = 0;
+/* Virtual time, i.e., key of the tag advertised most recently */
+static uint64_t vtime = 0;
+/* Number of advertisements queued with round-robin scheduling */
+static uint64_t sequence = 0;
+/* The table (generation) the heap was built for, and how many of its tags
+ * were queued (or skipped) */
+static const struct tagtable_t *table      = NULL;
+static unsigned int             generation = 0;
+static size_t                   scanned    = 0;
+
+/**
+ * @brief Compare two queue entries.
+ *
+ * @return bool true if a is to be advertised before b.
+ */
+static bool entry_before(const struct entry_t *a, const struct entry_t *b) {
+    return a->key < b->key || (a->key == b->key && a->id < b->id);
+}
+
+/**
+ * @brief Restore the heap property upwards from an entry.
+ *
+ * @param i Index of the entry.
+ */
+static void sift_up(size_t i) {
+    struct entry_t entry = heap[i];
+
+    while (i > 0 && entry_before(&entry, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i       = (i - 1) / 2;
+    }
+    heap[i] = entry;
+}
+
+/**
+ * @brief Restore the heap property downwards from an entry.
+ *
+ * @param i Index of the entry.
+ */
+static void sift_down(size_t i) {
+    struct entry_t entry = heap[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap_len) {
+            break;
+        }
+        if (child + 1 < heap_len
+            && entry_before(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!entry_before(&heap[child], &entry)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i       = child;
+    }
+    heap[i] = entry;
+}
+
+/**
+ * @brief Compute the key of a tag.
+ *
+ * @param adv    Pointer to the tag.
+ * @param served Key of the tag's last advertisement, or NULL if the tag is
+ *               new to the queue.
+ *
+ * @return uint64_t The key to queue the tag with.
+ */
+static uint64_t next_key(const struct airtag_adv_t *adv,
+                         const uint64_t            *served) {
+    switch (current_policy) {
+        case TAGSCHED_WEIGHTED_FAIR: {
+            /* Virtual finish time: the lower the weight, the further back */
+            uint64_t start = served != NULL ? *served : vtime;
+            return start
+                   + TAGSCHED_WEIGHT_SCALE / (adv->weight ? adv->weight : 1);
+        }
+        case TAGSCHED_EARLIEST_EXPIRY: {
+            /* Round in the upper half, expiry in the lower half */
+            uint64_t round  = (served != NULL ? *served : vtime) >> 32;
+            uint32_t expiry = adv->valid_to ? adv->valid_to : UINT32_MAX;
+            return ((round + (served != NULL)) << 32) | expiry;
+        }
+        case TAGSCHED_ROUND_ROBIN:
+        default: {
+            /* Queue the tag behind all others */
+            return ++sequence;
+        }
+    }
+}
+
+/**
+ * @brief Compare two queue entries by tag ID for sorting and searching.
+ */
+static int entry_cmp_id(const void *a, const void *b) {
+    uint32_t id_a = ((const struct entry_t *)a)->id;
+    uint32_t id_b = ((const struct entry_t *)b)->id;
+
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+/**
+ * @brief Rebuild the queue for a new table.
+ *
+ * Tags that were already queued keep their key (unless the policy changed),
+ * so changes to the table don't reset their share of the air time. Tags with a
+ * weight of 0 were retired (see tagstore_view_t) and are skipped.
+ *
+ * @param new_table Pointer to the pinned table.
+ * @param count     Number of tags in the table.
+ * @param keep      Whether to keep the keys of already queued tags.
+ */
+static void rebuild(const struct tagtable_t *new_table, int count, bool keep) {
+    struct entry_t *old     = heap;
+    size_t          old_len = heap_len;
+
+    qsort(old, old_len, sizeof(old[0]), entry_cmp_id);
+    heap     = old == heaps[0] ? heaps[1] : heaps[0];
+    heap_len = 0;
+    if (!keep) {
+        vtime    = 0;
+        sequence = 0;
+    }
+
+    for (scanned = 0; scanned < (size_t)count && heap_len < TAGSCHED_SIZE;
+         scanned++) {
+        const struct airtag_adv_t *adv   = &new_table->tags[scanned];
+        struct entry_t             entry = {.id = adv->id, .slot = scanned};
+        if (adv->weight == 0) {
+            continue;
+        }
+        struct entry_t *queued = keep ? bsearch(&entry, old, old_len,
+                                                sizeof(old[0]), entry_cmp_id)
+                                      : NULL;
+
+        entry.key        = queued != NULL ? queued->key : next_key(adv, NULL);
+        heap[heap_len++] = entry;
+    }
+    for (size_t i = heap_len / 2; i-- > 0;) {
+        sift_down(i);
+    }
+
+    ESP_LOGD(TAG, "Queued %zu tags (generation %u)", heap_len,
+             new_table->generation);
+    metrics_set(METRIC_TAGS_HELD, heap_len);
+    table      = new_table;
+    generation = new_table->generation;
+}
+
+/**
+ * @brief Parse the name of a scheduling policy (as sent by the server).
+ *
+ * @param str    NUL-terminated name of the policy, i.e., "round-robin",
+ *               "weighted-fair", or "earliest-expiry".
+ * @param policy Pointer to store the parsed policy into.
+ *
+ * @return bool true if the name denotes a known policy.
+ */
+bool tagsched_policy_from_str(const char *str, tagsched_policy_e *policy) {
+    for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]);
+         i++) {
+        if (strcmp(str, policy_names[i]) == 0) {
+            *policy = (tagsched_policy_e)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Switch over to another scheduling policy.
+ *
+ * Takes effect with the next call to tagsched_next(). May be called from any
+ * task.
+ *
+ * @param policy The policy to switch to.
+ */
+void tagsched_set_policy(tagsched_policy_e policy) {
+    atomic_store(&requested_policy, policy);
+}
+
+/**
+ * @brief Pick the next tag to advertise from the published tag table.
+ *
+ * The tags are kept in a priority queue ordered by the policy, so picking a
+ * tag takes O(log n) time. Changes to the tag table are picked up
+ * automatically, tags that stay in the table keep their place in the queue.
+ * Must only be called by the reader of the tag table.
+ *
+ * @param adv Pointer to the advertisement struct to copy the tag into.
+ *
+ * @return bool true if an advertisement was copied, false if the table is
+ *              empty.
+ */
+bool tagsched_next(struct airtag_adv_t *adv) {
+    const struct tagtable_t *pinned = tagtable_pin();
+    int                      count  = atomic_load(&pinned->count);
+    tagsched_policy_e        wanted = atomic_load(&requested_policy);
+
+    if (wanted != current_policy) {
+        ESP_LOGI(TAG, "Switching to %s scheduling", policy_names[wanted]);
+        current_policy = wanted;
+        rebuild(pinned, count, false);
+    } else if (pinned != table || pinned->generation != generation) {
+        rebuild(pinned, count, true);
+    } else {
+        /* Same table, but the writer may have appended tags to it */
+        for (; scanned < (size_t)count && heap_len < TAGSCHED_SIZE; scanned++) {
+            const struct airtag_adv_t *new_adv = &pinned->tags[scanned];
+            if (new_adv->weight == 0) {
+                continue;
+            }
+
+            heap[heap_len++] = (struct entry_t){
+                .key  = next_key(new_adv, NULL),
+                .id   = new_adv->id,
+                .slot = scanned,
+            };
+            sift_up(heap_len - 1);
+            metrics_set(METRIC_TAGS_HELD, heap_len);
+        }
+    }
+
+    bool found = heap_len > 0;
+    if (found) {
+        /* Advertise the first tag and queue it again */
+        *adv        = pinned->tags[heap[0].slot];
+        vtime       = heap[0].key;
+        heap[0].key = next_key(adv, &vtime);
+        sift_down(0);
+    }
+
+    tagtable_unpin();
+
+    return found;
+}
@@ -0,0 +1,55 @@
+#ifndef TAGSCHED_H
+#define TAGSCHED_H
+
+#include <stdbool.h>
+
+#include "airtag.h"
+
+/* Policies deciding which tag of the published table to advertise next */
+typedef enum {
+    /* Every tag in turn */
+    TAGSCHED_ROUND_ROBIN,
+    /* Every tag gets a share of the air time proportional to its weight */
+    TAGSCHED_WEIGHTED_FAIR,
+    /* Every tag once per round, but within a round the tags expiring first
+     * are advertised first */
+    TAGSCHED_EARLIEST_EXPIRY,
+} tagsched_policy_e;
+
+/**
+ * @brief Parse the name of a scheduling policy (as sent by the server).
+ *
+ * @param str    NUL-terminated name of the policy, i.e., "round-robin",
+ *               "weighted-fair", or "earliest-expiry".
+ * @param policy Pointer to store the parsed policy into.
+ *
+ * @return bool true if the name denotes a known policy.
+ */
+bool tagsched_policy_from_str(const char *str, tagsched_policy_e *policy);
+
+/**
+ * @brief Switch over to another scheduling policy.
+ *
+ * Takes effect with the next call to tagsched_next(). May be called from any
+ * task.
+ *
+ * @param policy The policy to switch to.
+ */
+void tagsched_set_policy(tagsched_policy_e policy);
+
+/**
+ * @brief Pick the next tag to advertise from the published tag table.
+ *
+ * The tags are kept in a priority queue ordered by the policy, so picking a
+ * tag takes O(log n) time. Changes to the tag table are picked up
+ * automatically, tags that stay in the table keep their place in the queue.
+ * Must only be called by the reader of the tag table.
+ *
+ * @param adv Pointer to the advertisement struct to copy the tag into.
+ *
+ * @return bool true if an advertisement was copied, false if the table is
+ *              empty.
+ */
+bool tagsched_next(struct airtag_adv_t *adv);
+
+#endif /* TAGSCHED_H */
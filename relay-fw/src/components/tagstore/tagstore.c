@@ -0,0 +1,670 @@
+#include "tagstore.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "spi_flash_mmap.h"
+
+#define TAGSTORE_MAGIC        0x53545350 /* "PSTS" in little endian */
+#define TAGSTORE_RECORD_LEN   sizeof(struct airtag_adv_t)
+#define TAGSTORE_LOG_OFFSET   32
+#define TAGSTORE_MAX_SEGMENTS                      \
+    ((TAGSTORE_HEADER_SPACE - TAGSTORE_LOG_OFFSET) \
+     / sizeof(struct segment_t))
+
+struct header_t {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t changes;
+    uint32_t record_len;
+    uint32_t crc;
+};
+
+/* Entry of the segment log, completing a segment of changes */
+struct segment_t {
+    uint32_t count;
+    uint32_t crc;
+};
+
+/* Location and size of a snapshot within the partition */
+struct snapshot_t {
+    size_t   offset;
+    uint32_t sequence;
+    /* Number of records, including the segments appended to the snapshot */
+    size_t   count;
+    size_t   segments;
+    /* Index of the first record the last commit added as a change */
+    size_t   changes;
+};
+
+static const char *const TAG = "TAGSTORE";
+
+static const esp_partition_t      *partition   = NULL;
+static const uint8_t              *mapped      = NULL;
+static esp_partition_mmap_handle_t mmap_handle = 0;
+/* Maximum number of records in a snapshot (including the segments appended to
+ * it), so that a new snapshot always fits next to the latest one */
+static size_t capacity = 0;
+/* Maximum number of tags in a full tag set */
+static size_t max_count = 0;
+
+static struct snapshot_t latest     = {0};
+static bool              has_latest = false;
+
+/* State of the snapshot being written */
+static struct snapshot_t pending = {0};
+static bool              writing = false;
+/* Whether changes are appended to the latest snapshot as a new segment */
+static bool appending = false;
+/* Index of the first change in the pending snapshot, changes replace the
+ * records with the same ID before them (SIZE_MAX for a full tag set) */
+static size_t first_change = SIZE_MAX;
+/* Whether the pending snapshot matches the latest one so far, in which case
+ * nothing has been written yet */
+static bool      unchanged  = false;
+static size_t    erased_end = 0;
+static uint32_t  crc        = 0;
+static esp_err_t write_err  = ESP_OK;
+
+/**
+ * @brief Compute the flash space taken up by a snapshot.
+ *
+ * @param count Number of records in the snapshot.
+ *
+ * @return size_t Size of the snapshot (in bytes), rounded up to full sectors.
+ */
+static size_t snapshot_size(size_t count) {
+    size_t size = TAGSTORE_HEADER_SPACE + count * TAGSTORE_RECORD_LEN;
+
+    return (size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE
+           * SPI_FLASH_SEC_SIZE;
+}
+
+/**
+ * @brief Get the (mapped) tags of a snapshot.
+ *
+ * @param snapshot Pointer to the snapshot.
+ *
+ * @return const struct airtag_adv_t* Pointer to the first tag.
+ */
+static const struct airtag_adv_t *
+snapshot_tags(const struct snapshot_t *snapshot) {
+    return (const struct airtag_adv_t *)(mapped + snapshot->offset
+                                         + TAGSTORE_HEADER_SPACE);
+}
+
+/**
+ * @brief Get the offset of a record within the partition.
+ *
+ * @param snapshot Pointer to the snapshot.
+ * @param index    Index of the record in the snapshot.
+ *
+ * @return size_t Offset of the record.
+ */
+static size_t record_offset(const struct snapshot_t *snapshot, size_t index) {
+    return snapshot->offset + TAGSTORE_HEADER_SPACE
+           + index * TAGSTORE_RECORD_LEN;
+}
+
+/**
+ * @brief Update a CRC with a record.
+ *
+ * The weight is left out, as retiring a record clears it in place.
+ *
+ * @param crc Current CRC.
+ * @param adv Pointer to the record.
+ *
+ * @return uint32_t The updated CRC.
+ */
+static uint32_t record_crc(uint32_t crc, const struct airtag_adv_t *adv) {
+    struct airtag_adv_t record = *adv;
+
+    record.weight = 0;
+
+    return esp_rom_crc32_le(crc, (const uint8_t *)&record,
+                            TAGSTORE_RECORD_LEN);
+}
+
+/**
+ * @brief Check whether a range of the partition is erased.
+ *
+ * @param offset Offset of the range.
+ * @param len    Length of the range.
+ *
+ * @return bool true if all bytes of the range are erased.
+ */
+static bool is_erased(size_t offset, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (mapped[offset + i] != 0xff) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Check whether a complete snapshot starts at the given offset.
+ *
+ * Picks up the segments appended to the snapshot up to the first one that is
+ * incomplete.
+ *
+ * @param offset   Offset of the sector to check.
+ * @param snapshot Pointer to store the snapshot's location into.
+ *
+ * @return bool true if a complete snapshot starts at the offset.
+ */
+static bool snapshot_load(size_t offset, struct snapshot_t *snapshot) {
+    struct header_t header = {0};
+
+    memcpy(&header, mapped + offset, sizeof(header));
+    size_t fits = (partition->size - offset - TAGSTORE_HEADER_SPACE)
+                  / TAGSTORE_RECORD_LEN;
+    if (header.magic != TAGSTORE_MAGIC
+        || header.record_len != TAGSTORE_RECORD_LEN || header.count > fits
+        || header.changes > header.count) {
+        return false;
+    }
+
+    *snapshot = (struct snapshot_t){
+        .offset   = offset,
+        .sequence = header.sequence,
+        .count    = header.count,
+        .segments = 0,
+        .changes  = header.changes,
+    };
+    const struct airtag_adv_t *tags  = snapshot_tags(snapshot);
+    uint32_t                   check = 0;
+    for (size_t i = 0; i < header.count; i++) {
+        check = record_crc(check, &tags[i]);
+    }
+    check = esp_rom_crc32_le(check, (const uint8_t *)&header,
+                             offsetof(struct header_t, crc));
+    if (check != header.crc) {
+        return false;
+    }
+
+    for (size_t i = 0; i < TAGSTORE_MAX_SEGMENTS; i++) {
+        struct segment_t segment = {0};
+        memcpy(&segment,
+               mapped + offset + TAGSTORE_LOG_OFFSET + i * sizeof(segment),
+               sizeof(segment));
+        if (segment.count <= snapshot->count || segment.count > fits) {
+            break;
+        }
+        check = 0;
+        for (size_t j = snapshot->count; j < segment.count; j++) {
+            check = record_crc(check, &tags[j]);
+        }
+        check = esp_rom_crc32_le(check, (const uint8_t *)&segment.count,
+                                 sizeof(segment.count));
+        if (check != segment.crc) {
+            break;
+        }
+        snapshot->changes  = snapshot->count;
+        snapshot->count    = segment.count;
+        snapshot->segments = i + 1;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Erase the sectors of the pending snapshot up to the given offset.
+ *
+ * @param end Offset up to which the partition must be writable.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t pending_prepare(size_t end) {
+    esp_err_t err = ESP_OK;
+
+    while (err == ESP_OK && erased_end < end) {
+        err = esp_partition_erase_range(partition, erased_end,
+                                        SPI_FLASH_SEC_SIZE);
+        erased_end += SPI_FLASH_SEC_SIZE;
+    }
+
+    return err;
+}
+
+/**
+ * @brief Write a record of the pending snapshot to flash.
+ *
+ * @param index Index of the record in the snapshot.
+ * @param adv   Pointer to the record (which must be in RAM).
+ */
+static void pending_write(size_t index, const struct airtag_adv_t *adv) {
+    size_t offset = record_offset(&pending, index);
+
+    if (write_err == ESP_OK) {
+        write_err = pending_prepare(offset + TAGSTORE_RECORD_LEN);
+    }
+    if (write_err == ESP_OK) {
+        write_err =
+            esp_partition_write(partition, offset, adv, TAGSTORE_RECORD_LEN);
+    }
+    crc = record_crc(crc, adv);
+}
+
+/**
+ * @brief Write out the records the pending snapshot shares with the latest
+ * one, once it turns out the snapshots differ.
+ */
+static void pending_diverge(void) {
+    const struct airtag_adv_t *tags = snapshot_tags(&latest);
+
+    unchanged = false;
+    for (size_t i = 0; i < pending.count; i++) {
+        /* Flash can't be written from a buffer in (mapped) flash */
+        struct airtag_adv_t adv = tags[i];
+        pending_write(i, &adv);
+    }
+}
+
+/**
+ * @brief Place a new snapshot next to the latest one.
+ *
+ * @param used Number of records the latest snapshot takes up, including
+ *             changes not committed yet.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t pending_start(size_t used) {
+    size_t size   = snapshot_size(capacity);
+    size_t offset = 0;
+
+    if (has_latest) {
+        /* Go on behind the latest snapshot, or wrap around */
+        size_t end = latest.offset + snapshot_size(used);
+        if (end + size <= partition->size) {
+            offset = end;
+        } else if (size > latest.offset) {
+            /* Only if the latest snapshot was written with a larger limit */
+            ESP_LOGE(TAG, "No room for a snapshot next to the latest one");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    pending = (struct snapshot_t){
+        .offset   = offset,
+        .sequence = has_latest ? latest.sequence + 1 : 1,
+        .count    = 0,
+        .segments = 0,
+    };
+    appending  = false;
+    erased_end = offset;
+    crc        = 0;
+    write_err  = ESP_OK;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Move the changes appended to the latest snapshot so far into a new
+ * snapshot, behind the tags of the latest one that weren't retired.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t pending_compact(void) {
+    const struct airtag_adv_t *tags = snapshot_tags(&latest);
+    size_t                     end  = pending.count;
+    esp_err_t                  err  = pending_start(end);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGI(TAG, "Compacting snapshot %" PRIu32 " into snapshot %" PRIu32,
+             latest.sequence, pending.sequence);
+    for (size_t i = 0; i < end; i++) {
+        /* Flash can't be written from a buffer in (mapped) flash */
+        struct airtag_adv_t adv = tags[i];
+        if (i == latest.count) {
+            first_change = pending.count;
+        }
+        if (i >= latest.count || adv.weight > 0) {
+            pending_write(pending.count++, &adv);
+        }
+    }
+    if (end == latest.count) {
+        first_change = pending.count;
+    }
+
+    return write_err;
+}
+
+/**
+ * @brief Retire the records the last changes committed to a snapshot replace.
+ *
+ * Retiring clears a record's weight in place, which flash allows without
+ * erasing it first. It only happens once the changes are committed, so a reset
+ * in between leaves both records in place, and retiring them again is
+ * harmless.
+ *
+ * @param snapshot Pointer to the snapshot.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t snapshot_retire(const struct snapshot_t *snapshot) {
+    const struct airtag_adv_t *tags = snapshot_tags(snapshot);
+    /* Flash can't be written from a buffer in (mapped) flash */
+    uint16_t  retired = 0;
+    esp_err_t err     = ESP_OK;
+
+    for (size_t i = snapshot->changes; i < snapshot->count; i++) {
+        for (size_t j = 0; j < i && err == ESP_OK; j++) {
+            if (tags[j].id == tags[i].id && tags[j].weight > 0) {
+                err = esp_partition_write(
+                    partition,
+                    record_offset(snapshot, j)
+                        + offsetof(struct airtag_adv_t, weight),
+                    &retired, sizeof(retired));
+            }
+        }
+    }
+
+    return err;
+}
+
+/**
+ * @brief Map the tag store partition and find the latest snapshot in it.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t tagstore_init(void) {
+    partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, TAGSTORE_PARTITION);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No " TAGSTORE_PARTITION " partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size,
+                                       ESP_PARTITION_MMAP_DATA,
+                                       (const void **)&mapped, &mmap_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not map partition: %s", esp_err_to_name(err));
+        partition = NULL;
+        return err;
+    }
+
+    /* Wherever the latest snapshot is, there's room for a new one either
+     * before or behind it if snapshots take up at most a third of the
+     * partition */
+    capacity = (partition->size / 3 / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE
+                - TAGSTORE_HEADER_SPACE)
+               / TAGSTORE_RECORD_LEN;
+    max_count = MIN(capacity, TAGSTORE_MAX_TAGS);
+    if (max_count < TAGSTORE_MAX_TAGS) {
+        ESP_LOGW(TAG, "Partition only fits snapshots of %zu tags", max_count);
+    }
+
+    has_latest = false;
+    for (size_t offset = 0; offset < partition->size;
+         offset += SPI_FLASH_SEC_SIZE) {
+        struct snapshot_t snapshot = {0};
+        if (snapshot_load(offset, &snapshot)
+            && (!has_latest || snapshot.sequence > latest.sequence)) {
+            latest     = snapshot;
+            has_latest = true;
+        }
+    }
+    if (has_latest) {
+        ESP_LOGI(TAG,
+                 "Found snapshot %" PRIu32 " of %zu records (%zu segments) at "
+                 "0x%zx",
+                 latest.sequence, latest.count, latest.segments, latest.offset);
+        /* A reset may have interrupted retiring the replaced records */
+        err = snapshot_retire(&latest);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Could not retire replaced records: %s",
+                     esp_err_to_name(err));
+        }
+    } else {
+        ESP_LOGI(TAG, "No snapshot found");
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the latest snapshot of the tag set.
+ *
+ * The snapshot stays mapped until the second tagstore_commit() after this
+ * call, as a new snapshot never overwrites the latest one. Records retired
+ * meanwhile have their weight cleared.
+ *
+ * @param view Pointer to the view to point at the snapshot.
+ *
+ * @return bool true if there is a snapshot, false if the store is empty.
+ */
+bool tagstore_get(struct tagstore_view_t *view) {
+    if (!has_latest) {
+        return false;
+    }
+    view->tags  = snapshot_tags(&latest);
+    view->count = latest.count;
+
+    return true;
+}
+
+/**
+ * @brief Start writing a new snapshot of the tag set.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t tagstore_begin(void) {
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = pending_start(latest.count);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    writing      = true;
+    first_change = SIZE_MAX;
+    unchanged    = has_latest;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Start appending changes to the tag set to the latest snapshot.
+ *
+ * Each appended tag replaces the stored tag with the same ID on commit,
+ * appended tags with a weight of 0 (tombstones) only remove it.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t tagstore_begin_update(void) {
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!has_latest) {
+        /* Changes to an empty tag set make up a full tag set */
+        esp_err_t err = tagstore_begin();
+        first_change  = 0;
+        return err;
+    }
+
+    pending      = latest;
+    writing      = true;
+    appending    = true;
+    first_change = latest.count;
+    unchanged    = false;
+    erased_end   = latest.offset + snapshot_size(latest.count);
+    crc          = 0;
+    write_err    = ESP_OK;
+
+    /* The segment goes into the next slot of the log and right behind the
+     * latest records, both of which a reset may have left partially written */
+    size_t log_offset  = latest.offset + TAGSTORE_LOG_OFFSET
+                         + latest.segments * sizeof(struct segment_t);
+    size_t records_end = record_offset(&latest, latest.count);
+    if (latest.segments >= TAGSTORE_MAX_SEGMENTS
+        || !is_erased(log_offset, sizeof(struct segment_t))
+        || !is_erased(records_end, erased_end - records_end)) {
+        write_err = pending_compact();
+    }
+    if (write_err != ESP_OK) {
+        writing = false;
+    }
+
+    return write_err;
+}
+
+/**
+ * @brief Append a tag to the snapshot being written.
+ *
+ * Nothing is written to flash as long as the snapshot matches the latest one,
+ * so storing an unchanged tag set doesn't wear out the flash.
+ *
+ * @param adv Pointer to the advertisement to append (may point into a
+ *            snapshot).
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the snapshot is full
+ *                   (for changes, even after compacting it), or another ESP
+ *                   status code if writing to flash failed.
+ */
+esp_err_t tagstore_append(const struct airtag_adv_t *adv) {
+    /* Flash can't be written from a buffer in (mapped) flash */
+    struct airtag_adv_t record = *adv;
+
+    if (!writing) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (write_err != ESP_OK) {
+        return write_err;
+    }
+    if (appending && pending.count >= capacity) {
+        /* The latest snapshot is full, start over with the live tags */
+        write_err = pending_compact();
+        if (write_err != ESP_OK) {
+            return write_err;
+        }
+    }
+    if (pending.count >= (first_change == SIZE_MAX ? max_count : capacity)) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (unchanged && pending.count < latest.count
+        && memcmp(&record, &snapshot_tags(&latest)[pending.count],
+                  TAGSTORE_RECORD_LEN)
+               == 0) {
+        pending.count++;
+        return ESP_OK;
+    }
+    if (unchanged) {
+        pending_diverge();
+    }
+    pending_write(pending.count++, &record);
+
+    return write_err;
+}
+
+/**
+ * @brief Complete the snapshot being written, making it the latest one.
+ *
+ * @param view Pointer to the view to point at the new latest snapshot.
+ *
+ * @return esp_err_t An ESP status code. On failure, the previous snapshot
+ *                   remains the latest one, unless only retiring the records
+ *                   the changes replace failed (which tagstore_init()
+ *                   completes).
+ */
+esp_err_t tagstore_commit(struct tagstore_view_t *view) {
+    struct header_t  header  = {0};
+    struct segment_t segment = {0};
+
+    if (!writing) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    writing = false;
+
+    if ((unchanged || appending) && pending.count == latest.count) {
+        ESP_LOGD(TAG, "Tag set unchanged, keeping snapshot %" PRIu32,
+                 latest.sequence);
+        tagstore_get(view);
+        return ESP_OK;
+    }
+    if (unchanged) {
+        /* The new tag set is a prefix of the latest one */
+        pending_diverge();
+    }
+    pending.changes = first_change == SIZE_MAX ? pending.count : first_change;
+
+    if (appending) {
+        /* Write the log entry last, it completes the segment */
+        segment.count = pending.count;
+        segment.crc   = esp_rom_crc32_le(crc, (const uint8_t *)&segment.count,
+                                         sizeof(segment.count));
+        if (write_err == ESP_OK) {
+            write_err = esp_partition_write(
+                partition,
+                pending.offset + TAGSTORE_LOG_OFFSET
+                    + pending.segments * sizeof(segment),
+                &segment, sizeof(segment));
+        }
+        pending.segments++;
+    } else {
+        /* Write the header last, it completes the snapshot */
+        header = (struct header_t){
+            .magic      = TAGSTORE_MAGIC,
+            .sequence   = pending.sequence,
+            .count      = pending.count,
+            .changes    = pending.changes,
+            .record_len = TAGSTORE_RECORD_LEN,
+        };
+        header.crc = esp_rom_crc32_le(crc, (const uint8_t *)&header,
+                                      offsetof(struct header_t, crc));
+        if (write_err == ESP_OK) {
+            write_err =
+                pending_prepare(pending.offset + TAGSTORE_HEADER_SPACE);
+        }
+        if (write_err == ESP_OK) {
+            write_err = esp_partition_write(partition, pending.offset,
+                                            &header, sizeof(header));
+        }
+    }
+    if (write_err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not write snapshot: %s",
+                 esp_err_to_name(write_err));
+        return write_err;
+    }
+
+    latest     = pending;
+    has_latest = true;
+
+    /* Only retire the replaced records once their replacements are
+     * committed */
+    esp_err_t err = snapshot_retire(&latest);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not retire replaced records: %s",
+                 esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG,
+             "Stored snapshot %" PRIu32 " of %zu records (%zu segments) at "
+             "0x%zx",
+             latest.sequence, latest.count, latest.segments, latest.offset);
+    tagstore_get(view);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Drop the snapshot being written.
+ *
+ * Changes already appended to the latest snapshot stay invisible, but the
+ * next segment can't go behind them, so the snapshot is compacted then.
+ */
+void tagstore_abort(void) {
+    writing = false;
+}
@@ -0,0 +1,119 @@
+#ifndef TAGSTORE_H
+#define TAGSTORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "airtag.h"
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/* The tag store keeps the last good tag set in a dedicated flash partition, so
+ * the relay can advertise right after booting and while the server is
+ * unreachable. The partition holds a ring of snapshots of the tag set, each
+ * starting at a sector boundary:
+ *
+ *   header:  magic "PSTS" (4) | sequence (4) | count (4) |
+ *            index of the first change (4) | record size (4) |
+ *            CRC-32 over the records and the preceding header fields (4)
+ *   log:     up to 28 segments, 32 bytes into the snapshot:
+ *            count (4) | CRC-32 over the segment's records and the count (4)
+ *   records: count * struct airtag_adv_t, TAGSTORE_HEADER_SPACE bytes into
+ *            the snapshot, followed by the records of the segments
+ *
+ * A full tag set is written as a new snapshot right behind the latest one
+ * (wrapping around at the end of the partition), so erases are spread evenly
+ * across the partition. Changes to the tag set are appended to the latest
+ * snapshot as a segment instead, which retires the records they replace by
+ * clearing their weight in place (the CRCs leave out the weights). Only once
+ * the log or the space reserved for the snapshot is full, the remaining tags
+ * and the changes are compacted into a new snapshot. The header and the log
+ * entries are written last, so a snapshot or segment torn by a reset is never
+ * picked up. Replaced records are only retired after that, and again after
+ * booting in case a reset interrupted it. Snapshots are read through a memory mapping of the partition, so
+ * they don't take up any RAM. */
+#define TAGSTORE_PARTITION    "tagstore"
+#define TAGSTORE_HEADER_SPACE 256
+#if CONFIG_TAGSTORE
+#define TAGSTORE_MAX_TAGS CONFIG_TAGSTORE_MAX_TAGS
+#else
+#define TAGSTORE_MAX_TAGS 0
+#endif /* CONFIG_TAGSTORE */
+
+/* A snapshot of the tag set, memory-mapped from flash. Records with a weight of
+ * 0 are retired or tombstones and don't belong to the tag set. */
+struct tagstore_view_t {
+    const struct airtag_adv_t *tags;
+    size_t                     count;
+};
+
+/**
+ * @brief Map the tag store partition and find the latest snapshot in it.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t tagstore_init(void);
+
+/**
+ * @brief Get the latest snapshot of the tag set.
+ *
+ * The snapshot stays mapped until the second tagstore_commit() after this
+ * call, as a new snapshot never overwrites the latest one. Records retired
+ * meanwhile have their weight cleared.
+ *
+ * @param view Pointer to the view to point at the snapshot.
+ *
+ * @return bool true if there is a snapshot, false if the store is empty.
+ */
+bool tagstore_get(struct tagstore_view_t *view);
+
+/**
+ * @brief Start writing a new snapshot of the tag set.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t tagstore_begin(void);
+
+/**
+ * @brief Start appending changes to the tag set to the latest snapshot.
+ *
+ * Each appended tag replaces the stored tag with the same ID on commit,
+ * appended tags with a weight of 0 (tombstones) only remove it.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t tagstore_begin_update(void);
+
+/**
+ * @brief Append a tag to the snapshot being written.
+ *
+ * Nothing is written to flash as long as the snapshot matches the latest one,
+ * so storing an unchanged tag set doesn't wear out the flash.
+ *
+ * @param adv Pointer to the advertisement to append (may point into a
+ *            snapshot).
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the snapshot is full
+ *                   (for changes, even after compacting it), or another ESP
+ *                   status code if writing to flash failed.
+ */
+esp_err_t tagstore_append(const struct airtag_adv_t *adv);
+
+/**
+ * @brief Complete the snapshot being written, making it the latest one.
+ *
+ * @param view Pointer to the view to point at the new latest snapshot.
+ *
+ * @return esp_err_t An ESP status code. On failure, the previous snapshot
+ *                   remains the latest one, unless only retiring the records
+ *                   the changes replace failed (which tagstore_init()
+ *                   completes).
+ */
+esp_err_t tagstore_commit(struct tagstore_view_t *view);
+
+/**
+ * @brief Drop the snapshot being written.
+ */
+void tagstore_abort(void);
+
+#endif /* TAGSTORE_H */
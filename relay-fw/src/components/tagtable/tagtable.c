@@ -0,0 +1,199 @@
+#include "tagtable.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static struct tagtable_t tables[2] = {
+    {.tags = tables[0].storage},
+    {.tags = tables[1].storage},
+};
+
+/* The table currently published to the reader */
+static struct tagtable_t *_Atomic active = &tables[0];
+/* The table the reader is currently copying from (if any). The writer must
+ * not touch this table until the reader has released it again. */
+static struct tagtable_t *_Atomic pinned = NULL;
+/* Generation of the table filled most recently */
+static unsigned int generation = 0;
+
+/**
+ * @brief Get the back table for filling it with a new set of tags.
+ *
+ * Waits until the reader no longer accesses the back table (which it can only
+ * do while picking a single tag if it got hold of the table right before the
+ * last swap) and empties it.
+ * Must only be called by the writer.
+ *
+ * @return struct tagtable_t* Pointer to the emptied back table.
+ */
+struct tagtable_t *tagtable_begin(void) {
+    struct tagtable_t *back =
+        atomic_load(&active) == &tables[0] ? &tables[1] : &tables[0];
+
+    while (atomic_load(&pinned) == back) {
+        vTaskDelay(1);
+    }
+    atomic_store(&back->count, 0);
+    back->tags       = back->storage;
+    back->generation = ++generation;
+
+    return back;
+}
+
+/**
+ * @brief Get the back table for updating a copy of the published table.
+ *
+ * Same as tagtable_begin(), but the back table starts out as a copy of the
+ * currently published table.
+ * Must only be called by the writer.
+ *
+ * @return struct tagtable_t* Pointer to the back table.
+ */
+struct tagtable_t *tagtable_begin_update(void) {
+    /* Only the writer modifies tables, so the front table is stable here */
+    struct tagtable_t *front = atomic_load(&active);
+    struct tagtable_t *back  = tagtable_begin();
+    int                count = MIN(atomic_load(&front->count), TAGTABLE_SIZE);
+
+    memcpy(back->storage, front->tags, count * sizeof(back->storage[0]));
+    atomic_store(&back->count, count);
+
+    return back;
+}
+
+/**
+ * @brief Append an advertisement to a table.
+ *
+ * The advertisement becomes visible to the reader (if the table is already
+ * published) only once it is completely copied.
+ * Must only be called by the writer.
+ *
+ * @param table Pointer to the table returned by tagtable_begin().
+ * @param adv   Pointer to the advertisement to append.
+ *
+ * @return bool true if the advertisement was appended, false if the table is
+ *              full.
+ */
+bool tagtable_append(struct tagtable_t *table, const struct airtag_adv_t *adv) {
+    int count = atomic_load(&table->count);
+    if (count >= TAGTABLE_SIZE) {
+        return false;
+    }
+    table->storage[count] = *adv;
+    atomic_store(&table->count, count + 1);
+
+    return true;
+}
+
+/**
+ * @brief Replace the advertisement with the same ID or append it.
+ *
+ * Must only be called by the writer and only on a table that is not published
+ * yet.
+ *
+ * @param table Pointer to the table returned by tagtable_begin_update().
+ * @param adv   Pointer to the advertisement to insert.
+ *
+ * @return bool true if the advertisement was inserted, false if the table is
+ *              full.
+ */
+bool tagtable_upsert(struct tagtable_t *table, const struct airtag_adv_t *adv) {
+    int count = atomic_load(&table->count);
+    for (int i = 0; i < count; i++) {
+        if (table->storage[i].id == adv->id) {
+            table->storage[i] = *adv;
+            return true;
+        }
+    }
+
+    return tagtable_append(table, adv);
+}
+
+/**
+ * @brief Remove the advertisement with the given ID (if any) from a table.
+ *
+ * Must only be called by the writer and only on a table that is not published
+ * yet.
+ *
+ * @param table Pointer to the table returned by tagtable_begin_update().
+ * @param id    ID of the AirTag to remove.
+ */
+void tagtable_remove(struct tagtable_t *table, uint32_t id) {
+    int count = atomic_load(&table->count);
+    for (int i = 0; i < count; i++) {
+        if (table->storage[i].id == id) {
+            /* Order doesn't matter, so just move the last tag into the gap */
+            table->storage[i] = table->storage[count - 1];
+            atomic_store(&table->count, count - 1);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Point a table at tags stored elsewhere instead of its own storage.
+ *
+ * The tags must stay unchanged as long as the table is published or pinned.
+ * The table can't be appended to until the next tagtable_begin().
+ * Must only be called by the writer and only on a table that is not published
+ * yet.
+ *
+ * @param table Pointer to the table returned by tagtable_begin().
+ * @param tags  Pointer to the first tag.
+ * @param count Number of tags.
+ */
+void tagtable_set_view(struct tagtable_t         *table,
+                       const struct airtag_adv_t *tags, int count) {
+    table->tags = tags;
+    atomic_store(&table->count, count);
+}
+
+/**
+ * @brief Publish a table filled after a call to tagtable_begin().
+ *
+ * The table is swapped in with a single atomic pointer store, so the reader
+ * never has to wait for the writer.
+ * Must only be called by the writer.
+ *
+ * @param table Pointer to the table returned by tagtable_begin().
+ */
+void tagtable_publish(struct tagtable_t *table) {
+    atomic_store(&active, table);
+}
+
+/**
+ * @brief Pin the currently published table for reading.
+ *
+ * The writer doesn't reuse a pinned table, so its tags stay valid until the
+ * table is released again via tagtable_unpin(). Tags may still be appended to
+ * the table in the meantime. Readers should only keep a table pinned for a
+ * short while, as the writer waits for it before filling a new table.
+ * Must only be called by the reader.
+ *
+ * @return const struct tagtable_t* Pointer to the pinned table.
+ */
+const struct tagtable_t *tagtable_pin(void) {
+    struct tagtable_t *table = NULL;
+
+    /* Re-check after pinning, as the writer may have swapped tables (and
+     * started to reuse the old one) in the meantime */
+    do {
+        table = atomic_load(&active);
+        atomic_store(&pinned, table);
+    } while (table != atomic_load(&active));
+
+    return table;
+}
+
+/**
+ * @brief Release the table pinned via tagtable_pin().
+ *
+ * Must only be called by the reader.
+ */
+void tagtable_unpin(void) {
+    atomic_store(&pinned, NULL);
+}
@@ -0,0 +1,138 @@
+#ifndef TAGTABLE_H
+#define TAGTABLE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "airtag.h"
+#include "sdkconfig.h"
+
+#define TAGTABLE_SIZE CONFIG_NUM_TAGS
+
+/* A table of pre-decoded advertisements. Two of these are double-buffered
+ * between the (single) writer filling the back table and the (single) reader
+ * advertising from the front table. Tables are append-only until the next
+ * tagtable_begin(), so the writer may keep appending to a table it already
+ * published. Each table filled after a tagtable_begin() gets a new generation,
+ * so the reader can tell apart a reused table from the one it saw before.
+ * Readers access the tags through the tags pointer, which points either at the
+ * table's own storage or at tags stored elsewhere (see tagtable_set_view()). */
+struct tagtable_t {
+    unsigned int               generation;
+    atomic_int                 count;
+    const struct airtag_adv_t *tags;
+    struct airtag_adv_t        storage[TAGTABLE_SIZE];
+};
+
+/**
+ * @brief Get the back table for filling it with a new set of tags.
+ *
+ * Waits until the reader no longer accesses the back table (which it can only
+ * do while picking a single tag if it got hold of the table right before the
+ * last swap) and empties it.
+ * Must only be called by the writer.
+ *
+ * @return struct tagtable_t* Pointer to the emptied back table.
+ */
+struct tagtable_t *tagtable_begin(void);
+
+/**
+ * @brief Get the back table for updating a copy of the published table.
+ *
+ * Same as tagtable_begin(), but the back table starts out as a copy of the
+ * currently published table.
+ * Must only be called by the writer.
+ *
+ * @return struct tagtable_t* Pointer to the back table.
+ */
+struct tagtable_t *tagtable_begin_update(void);
+
+/**
+ * @brief Append an advertisement to a table.
+ *
+ * The advertisement becomes visible to the reader (if the table is already
+ * published) only once it is completely copied.
+ * Must only be called by the writer.
+ *
+ * @param table Pointer to the table returned by tagtable_begin().
+ * @param adv   Pointer to the advertisement to append.
+ *
+ * @return bool true if the advertisement was appended, false if the table is
+ *              full.
+ */
+bool tagtable_append(struct tagtable_t *table, const struct airtag_adv_t *adv);
+
+/**
+ * @brief Replace the advertisement with the same ID or append it.
+ *
+ * Must only be called by the writer and only on a table that is not published
+ * yet.
+ *
+ * @param table Pointer to the table returned by tagtable_begin_update().
+ * @param adv   Pointer to the advertisement to insert.
+ *
+ * @return bool true if the advertisement was inserted, false if the table is
+ *              full.
+ */
+bool tagtable_upsert(struct tagtable_t *table, const struct airtag_adv_t *adv);
+
+/**
+ * @brief Remove the advertisement with the given ID (if any) from a table.
+ *
+ * Must only be called by the writer and only on a table that is not published
+ * yet.
+ *
+ * @param table Pointer to the table returned by tagtable_begin_update().
+ * @param id    ID of the AirTag to remove.
+ */
+void tagtable_remove(struct tagtable_t *table, uint32_t id);
+
+/**
+ * @brief Point a table at tags stored elsewhere instead of its own storage.
+ *
+ * The tags must stay unchanged as long as the table is published or pinned.
+ * The table can't be appended to until the next tagtable_begin().
+ * Must only be called by the writer and only on a table that is not published
+ * yet.
+ *
+ * @param table Pointer to the table returned by tagtable_begin().
+ * @param tags  Pointer to the first tag.
+ * @param count Number of tags.
+ */
+void tagtable_set_view(struct tagtable_t         *table,
+                       const struct airtag_adv_t *tags, int count);
+
+/**
+ * @brief Publish a table filled after a call to tagtable_begin().
+ *
+ * The table is swapped in with a single atomic pointer store, so the reader
+ * never has to wait for the writer.
+ * Must only be called by the writer.
+ *
+ * @param table Pointer to the table returned by tagtable_begin().
+ */
+void tagtable_publish(struct tagtable_t *table);
+
+/**
+ * @brief Pin the currently published table for reading.
+ *
+ * The writer doesn't reuse a pinned table, so its tags stay valid until the
+ * table is released again via tagtable_unpin(). Tags may still be appended to
+ * the table in the meantime. Readers should only keep a table pinned for a
+ * short while, as the writer waits for it before filling a new table.
+ * Must only be called by the reader.
+ *
+ * @return const struct tagtable_t* Pointer to the pinned table.
+ */
+const struct tagtable_t *tagtable_pin(void);
+
+/**
+ * @brief Release the table pinned via tagtable_pin().
+ *
+ * Must only be called by the reader.
+ */
+void tagtable_unpin(void);
+
+#endif /* TAGTABLE_H */
@@ -0,0 +1,415 @@
+#include "advertiser.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "airtag.h"
+#include "esp_bt_defs.h"
+#include "esp_gap_ble_api.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "tagreport.h"
+#include "tagsched.h"
+
+#define BLE_ADVERTISEMENT_INTERVAL CONFIG_BLE_ADVERTISEMENT_INTERVAL
+#define BLE_ADVERTISEMENT_DURATION CONFIG_BLE_ADVERTISEMENT_DURATION
+#if CONFIG_BLE_MULTI_ADV
+#define BLE_ADV_SETS CONFIG_BLE_ADV_SETS
+#else
+#define BLE_ADV_SETS 1
+#endif /* CONFIG_BLE_MULTI_ADV */
+/* Time between switching over one of the advertising sets to the next tag,
+ * such that every tag is on air for the full advertisement duration */
+#define BLE_ADV_SWITCH_INTERVAL (BLE_ADVERTISEMENT_DURATION / BLE_ADV_SETS)
+
+/* States of an advertising set while switching over to the next tag. Each
+ * state but idle and advertising waits for the completion event of the GAP
+ * command issued when entering the state. */
+typedef enum {
+    ADV_IDLE,
+    ADV_STOPPING,
+    ADV_SETTING_ADDR,
+    ADV_SETTING_DATA,
+    ADV_STARTING,
+    ADV_ADVERTISING,
+} adv_state_e;
+
+struct adv_set_t {
+    _Atomic adv_state_e state;
+    /* ID of the tag on air (or being switched away from), 0 while idle as the
+     * server numbers tags from 1. Written by the BLE event handler and read by
+     * the advertiser task, so it's a single atomic that needs no state. */
+    _Atomic uint32_t current_id;
+    /* The tag to switch over to, prepared before the switch starts */
+    struct airtag_adv_t next;
+    bool                has_next;
+    /* Time the switch started at, i.e., the previous tag went off air */
+    int64_t switch_start;
+    bool    switching;
+    /* Time the GAP command of the current state was issued at */
+    int64_t command_start;
+};
+
+static const char *const TAG = "ADVERTISER";
+
+/* Only used to wait for the advertising sets to be set up */
+static SemaphoreHandle_t ble_sem = NULL;
+
+static struct adv_set_t sets[BLE_ADV_SETS] = {0};
+
+static struct advertiser_stats_t stats      = {0};
+static portMUX_TYPE              stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_BLE_MULTI_ADV
+/* BLE extended advertisement parameters, using legacy advertising PDUs as
+ * that's what AirTags use */
+static const esp_ble_gap_ext_adv_params_t ext_adv_params = {
+    .type = ESP_BLE_GAP_SET_EXT_ADV_PROP_LEGACY_IND,
+    .interval_min = BLE_ADVERTISEMENT_INTERVAL
+                    / 0.625, /* Interval (in ms) = interval * 0.625 */
+    .interval_max   = BLE_ADVERTISEMENT_INTERVAL / 0.625,
+    .channel_map    = ADV_CHNL_ALL,
+    .own_addr_type  = BLE_ADDR_TYPE_RANDOM,
+    .filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+    .tx_power       = EXT_ADV_TX_PWR_NO_PREFERENCE,
+    .primary_phy    = ESP_BLE_GAP_PHY_1M,
+    .secondary_phy  = ESP_BLE_GAP_PHY_1M,
+    .scan_req_notif = false,
+};
+#else
+/* BLE advertisement parameters */
+static esp_ble_adv_params_t adv_params = {
+    .adv_int_min = BLE_ADVERTISEMENT_INTERVAL
+                   / 0.625, /* Interval (in ms) = interval * 0.625 */
+    .adv_int_max   = BLE_ADVERTISEMENT_INTERVAL / 0.625,
+    .adv_type      = ADV_TYPE_IND,
+    .own_addr_type = BLE_ADDR_TYPE_RANDOM,
+    .channel_map   = ADV_CHNL_ALL,
+};
+#endif /* CONFIG_BLE_MULTI_ADV */
+
+/**
+ * @brief Record the dead air of a completed switch-over.
+ *
+ * @param dead_air Time (in us) between the previous tag going off air and the
+ *                 next tag going on air.
+ */
+static void record_switch(int64_t dead_air) {
+    portENTER_CRITICAL(&stats_lock);
+    stats.switches++;
+    stats.dead_air_last_us = dead_air;
+    stats.dead_air_total_us += dead_air;
+    if (dead_air > stats.dead_air_max_us) {
+        stats.dead_air_max_us = dead_air;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    metrics_observe(METRIC_DEAD_AIR, dead_air);
+    ESP_LOGD(TAG, "Switched tags with %" PRId64 " us of dead air", dead_air);
+}
+
+/**
+ * @brief Enter a state and issue the GAP command associated with it.
+ *
+ * @param set   Index of the advertising set (always 0 for legacy advertising).
+ * @param state The state to enter.
+ */
+static void adv_enter(uint8_t set, adv_state_e state) {
+    struct adv_set_t *adv_set = &sets[set];
+
+    atomic_store(&adv_set->state, state);
+    adv_set->command_start = esp_timer_get_time();
+    switch (state) {
+        case ADV_STOPPING: {
+            adv_set->switch_start = esp_timer_get_time();
+            adv_set->switching    = true;
+#if CONFIG_BLE_MULTI_ADV
+            ESP_ERROR_CHECK(esp_ble_gap_ext_adv_stop(1, &set));
+#else
+            ESP_ERROR_CHECK(esp_ble_gap_stop_advertising());
+#endif /* CONFIG_BLE_MULTI_ADV */
+            break;
+        }
+        case ADV_SETTING_ADDR: {
+#if CONFIG_BLE_MULTI_ADV
+            ESP_ERROR_CHECK(
+                esp_ble_gap_ext_adv_set_rand_addr(set, adv_set->next.addr));
+#else
+            ESP_ERROR_CHECK(esp_ble_gap_set_rand_addr(adv_set->next.addr));
+#endif /* CONFIG_BLE_MULTI_ADV */
+            break;
+        }
+        case ADV_SETTING_DATA: {
+#if CONFIG_BLE_MULTI_ADV
+            ESP_ERROR_CHECK(esp_ble_gap_config_ext_adv_data_raw(
+                set, sizeof(adv_set->next.payload), adv_set->next.payload));
+#else
+            ESP_ERROR_CHECK(esp_ble_gap_config_adv_data_raw(
+                adv_set->next.payload, sizeof(adv_set->next.payload)));
+#endif /* CONFIG_BLE_MULTI_ADV */
+            break;
+        }
+        case ADV_STARTING: {
+#if CONFIG_BLE_MULTI_ADV
+            const esp_ble_gap_ext_adv_t ext_adv = {.instance = set};
+            ESP_ERROR_CHECK(esp_ble_gap_ext_adv_start(1, &ext_adv));
+#else
+            ESP_ERROR_CHECK(esp_ble_gap_start_advertising(&adv_params));
+#endif /* CONFIG_BLE_MULTI_ADV */
+            break;
+        }
+        case ADV_ADVERTISING: {
+            atomic_store(&adv_set->current_id, adv_set->next.id);
+#if CONFIG_COVERAGE_REPORT
+            /* The tag stays on air until the set switches over again, i.e.,
+             * for the advertisement duration */
+            tagreport_record(adv_set->next.id);
+#endif /* CONFIG_COVERAGE_REPORT */
+            if (adv_set->switching) {
+                record_switch(esp_timer_get_time() - adv_set->switch_start);
+            }
+            adv_set->switching = false;
+            break;
+        }
+        default: {
+            atomic_store(&adv_set->current_id, 0);
+            adv_set->switching = false;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Advance the state machine of an advertising set.
+ *
+ * Called whenever the GAP command of the set's current state completed, this
+ * issues the next command right away, without a round-trip through the
+ * advertiser task.
+ *
+ * @param set    Index of the advertising set (always 0 for legacy
+ *               advertising).
+ * @param status Status of the completed GAP command.
+ */
+static void adv_step(uint8_t set, esp_bt_status_t status) {
+    if (set >= BLE_ADV_SETS) {
+        return;
+    }
+    struct adv_set_t *adv_set = &sets[set];
+
+    metrics_observe(METRIC_GAP_LATENCY,
+                    esp_timer_get_time() - adv_set->command_start);
+    if (status != ESP_BT_STATUS_SUCCESS) {
+        metrics_count(METRIC_GAP_ERRORS, 1);
+        ESP_LOGW(TAG, "GAP command for set %u failed in state %d: %d", set,
+                 atomic_load(&adv_set->state), status);
+        adv_enter(set, ADV_IDLE);
+        return;
+    }
+
+    switch (atomic_load(&adv_set->state)) {
+        case ADV_STOPPING: {
+            /* Only continue if there's a tag to switch over to */
+            adv_enter(set, adv_set->has_next ? ADV_SETTING_ADDR : ADV_IDLE);
+            break;
+        }
+        case ADV_SETTING_ADDR: {
+            adv_enter(set, ADV_SETTING_DATA);
+            break;
+        }
+        case ADV_SETTING_DATA: {
+            adv_enter(set, ADV_STARTING);
+            break;
+        }
+        case ADV_STARTING: {
+            adv_enter(set, ADV_ADVERTISING);
+            break;
+        }
+        default: {
+            ESP_LOGW(TAG, "Unexpected GAP event for set %u", set);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Handle BLE events.
+ *
+ * The handler is responsible for reacting to BLE events (e.g., advertisement
+ * address/data set, advertisements started/stopped).
+ * Every completion event advances the state machine of the corresponding
+ * advertising set, which immediately issues the next GAP command. This
+ * behavior synchronizes the software commands with the hardware.
+ *
+ * @param event Enum value denoting the event type.
+ * @param param A pointer to additional data associated with an event..
+ */
+static void ble_gap_event_handler(esp_gap_ble_cb_event_t  event,
+                                  esp_ble_gap_cb_param_t *param) {
+    ESP_LOGD("BLE", "In event handler");
+    switch (event) {
+#if CONFIG_BLE_MULTI_ADV
+        case ESP_GAP_BLE_EXT_ADV_SET_PARAMS_COMPLETE_EVT: {
+            if (ble_sem != NULL) {
+                /* Let the advertiser task (which is setting up the sets)
+                 * continue */
+                xSemaphoreGive(ble_sem);
+            }
+            break;
+        }
+        case ESP_GAP_BLE_EXT_ADV_SET_RAND_ADDR_COMPLETE_EVT: {
+            adv_step(param->ext_adv_set_rand_addr.instance,
+                     param->ext_adv_set_rand_addr.status);
+            break;
+        }
+        case ESP_GAP_BLE_EXT_ADV_DATA_SET_COMPLETE_EVT: {
+            adv_step(param->ext_adv_data_set.instance,
+                     param->ext_adv_data_set.status);
+            break;
+        }
+        case ESP_GAP_BLE_EXT_ADV_START_COMPLETE_EVT: {
+            for (uint8_t i = 0; i < param->ext_adv_start.instance_num; i++) {
+                adv_step(param->ext_adv_start.instance[i],
+                         param->ext_adv_start.status);
+            }
+            break;
+        }
+        case ESP_GAP_BLE_EXT_ADV_STOP_COMPLETE_EVT: {
+            for (uint8_t i = 0; i < param->ext_adv_stop.instance_num; i++) {
+                adv_step(param->ext_adv_stop.instance[i],
+                         param->ext_adv_stop.status);
+            }
+            break;
+        }
+#else
+        case ESP_GAP_BLE_SET_STATIC_RAND_ADDR_EVT: {
+            adv_step(0, param->set_rand_addr_cmpl.status);
+            break;
+        }
+        case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT: {
+            adv_step(0, param->adv_data_raw_cmpl.status);
+            break;
+        }
+        case ESP_GAP_BLE_ADV_START_COMPLETE_EVT: {
+            adv_step(0, param->adv_start_cmpl.status);
+            break;
+        }
+        case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT: {
+            adv_step(0, param->adv_stop_cmpl.status);
+            break;
+        }
+#endif /* CONFIG_BLE_MULTI_ADV */
+        default: {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Prepare the next tag for an advertising set.
+ *
+ * @param set Index of the advertising set (always 0 for legacy advertising).
+ *
+ * @return bool true if there is a tag to switch over to.
+ */
+static bool adv_prepare(uint8_t set) {
+    struct adv_set_t   *adv_set = &sets[set];
+    struct airtag_adv_t adv     = {0};
+
+    if (!tagsched_next(&adv)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < BLE_ADV_SETS; i++) {
+        /* With fewer tags than sets, don't send a tag twice */
+        if (i != set && atomic_load(&sets[i].current_id) == adv.id) {
+            return false;
+        }
+    }
+    adv_set->next = adv;
+
+    return true;
+}
+
+/**
+ * @brief Set up the advertiser.
+ *
+ * Must be called once the Bluedroid stack is enabled and before starting the
+ * advertiser task.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t advertiser_init(void) {
+    if ((ble_sem = xSemaphoreCreateBinary()) == NULL) {
+        ESP_LOGE(TAG, "Semaphore couldn't be initialized");
+        return ESP_ERR_NO_MEM;
+    }
+    /* Add event handler that drives the advertising sets */
+    return esp_ble_gap_register_callback(ble_gap_event_handler);
+}
+
+/**
+ * @brief Retrieve statistics on the switch-overs between tags.
+ *
+ * @param out Pointer to the struct to copy the statistics into.
+ */
+void advertiser_get_stats(struct advertiser_stats_t *out) {
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief The FreeRTOS BLE advertisement task.
+ *
+ * This task paces the switch-overs between the pre-decoded AirTag
+ * advertisements. It prepares the next tag of an advertising set and kicks
+ * off the switch-over, which the BLE event handler then drives to completion.
+ * With multiple advertising sets, it switches over one set at a time to the
+ * next tag, so that the other sets keep advertising in the meantime.
+ *
+ * @param params (unused, required for task function prototype)
+ */
+void advertiser_task(void *params) {
+    uint8_t    set       = 0;
+    TickType_t last_wake = 0;
+
+    assert(sizeof(esp_bd_addr_t) >= ADDR_LEN);
+#if CONFIG_BLE_MULTI_ADV
+    for (uint8_t i = 0; i < BLE_ADV_SETS; i++) {
+        ESP_ERROR_CHECK(esp_ble_gap_ext_adv_set_params(i, &ext_adv_params));
+        xSemaphoreTake(ble_sem, portMAX_DELAY);
+    }
+    ESP_LOGI(TAG, "Advertising in %d sets concurrently", BLE_ADV_SETS);
+#endif /* CONFIG_BLE_MULTI_ADV */
+
+    last_wake = xTaskGetTickCount();
+    for (;;) {
+        struct adv_set_t *adv_set = &sets[set];
+        adv_state_e       state   = atomic_load(&adv_set->state);
+
+        if (state == ADV_IDLE || state == ADV_ADVERTISING) {
+            /* Prepare the next tag before the current one goes off air, then
+             * kick off the switch-over */
+            adv_set->has_next = adv_prepare(set);
+            if (state == ADV_ADVERTISING) {
+                adv_enter(set, ADV_STOPPING);
+            } else if (adv_set->has_next) {
+                adv_enter(set, ADV_SETTING_ADDR);
+            }
+        } else {
+            ESP_LOGW(TAG, "Set %u still switching over, skipping", set);
+        }
+
+        /* Wait for a bit before we switch over the next set */
+        vTaskDelayUntil(&last_wake,
+                        BLE_ADV_SWITCH_INTERVAL / portTICK_PERIOD_MS);
+        set = (set + 1) % BLE_ADV_SETS;
+    }
+
+    /* Cannot arrive here due to infinite loop above */
+    __builtin_unreachable();
+}
@@ -0,0 +1,45 @@
+#ifndef ADVERTISER_H
+#define ADVERTISER_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* Statistics on the switch-overs between tags. Dead air is the time between
+ * the previous tag of an advertising set going off air and the next tag going
+ * on air. */
+struct advertiser_stats_t {
+    uint32_t switches;
+    int64_t  dead_air_last_us;
+    int64_t  dead_air_max_us;
+    int64_t  dead_air_total_us;
+};
+
+/**
+ * @brief Set up the advertiser.
+ *
+ * Must be called once the Bluedroid stack is enabled and before starting the
+ * advertiser task.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+esp_err_t advertiser_init(void);
+
+/**
+ * @brief Retrieve statistics on the switch-overs between tags.
+ *
+ * @param out Pointer to the struct to copy the statistics into.
+ */
+void advertiser_get_stats(struct advertiser_stats_t *out);
+
+/**
+ * @brief The FreeRTOS BLE advertisement task.
+ *
+ * This task paces the switch-overs between the pre-decoded AirTag
+ * advertisements, which the BLE event handler then drives to completion.
+ *
+ * @param params (unused, required for task function prototype)
+ */
+void advertiser_task(void *params);
+
+#endif /* ADVERTISER_H */
@@ -1,28 +1,38 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
 
+#include "advertiser.h"
 #include "airtag.h"
 #include "esp_bt.h"
 #include "esp_bt_defs.h"
 #include "esp_bt_main.h"
 #include "esp_err.h"
 #include "esp_event.h"
-#include "esp_gap_ble_api.h"
 #include "esp_http_client.h"
 #include "esp_log.h"
+#include "esp_mac.h"
 #include "esp_netif.h"
 #include "esp_netif_net_stack.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
-#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "jsonstream.h"
 #include "lwip/err.h"
 #include "lwip/inet.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
+#include "metrics.h"
 #include "mjson.h"
+#include "tagfeed.h"
+#include "tagreport.h"
+#include "tagsched.h"
+#include "tagstore.h"
+#include "tagtable.h"
 
 #define STR(s)  xSTR(s)
 #define xSTR(s) #s
@@ -37,17 +47,44 @@
 #define RELAY_ENDPOINT_HOST     CONFIG_RELAY_ENDPOINT_HOST
 #define RELAY_ENDPOINT_PORT     CONFIG_RELAY_ENDPOINT_PORT
 #define RELAY_DOWNLOAD_INTERVAL CONFIG_RELAY_DOWNLOAD_INTERVAL
+#if CONFIG_ADAPTIVE_POLL
+/* Bounds (in ms) of the poll interval the server may ask for */
+#define ADAPTIVE_POLL_MIN_INTERVAL 1000
+#define ADAPTIVE_POLL_MAX_INTERVAL CONFIG_ADAPTIVE_POLL_MAX_INTERVAL
+#endif /* CONFIG_ADAPTIVE_POLL */
+#if CONFIG_LONG_POLL
+#define LONG_POLL_TIMEOUT CONFIG_LONG_POLL_TIMEOUT
+/* Leave the server some slack to answer a request held for the full timeout */
+#define HTTP_TIMEOUT_MS ((LONG_POLL_TIMEOUT + 10) * 1000)
+#define SINCE_QUERY     "&wait=" STR(LONG_POLL_TIMEOUT) "&since="
+#else
+#define HTTP_TIMEOUT_MS 5000
+#define SINCE_QUERY     "&since="
+#endif /* CONFIG_LONG_POLL */
 #if CONFIG_VALID_TAGS_ONLY
 #define VALID_TAGS_ONLY "true"
 #else
 #define VALID_TAGS_ONLY "false"
 #endif /* CONFIG_VALID_TAGS_ONLY */
+#if CONFIG_METRICS
+#define METRICS_PORT CONFIG_METRICS_PORT
+#endif /* CONFIG_METRICS */
+#if CONFIG_TAGSTORE
+/* The tag store holds more tags than fit into RAM */
+#define NUM_TAGS CONFIG_TAGSTORE_MAX_TAGS
+#else
 #define NUM_TAGS CONFIG_NUM_TAGS
+#endif /* CONFIG_TAGSTORE */
 #if CONFIG_ROTATE_TAGS
 #define ROTATE_TAGS "true"
 #else
 #define ROTATE_TAGS "false"
 #endif /* CONFIG_ROTATE_TAGS */
+#if CONFIG_BINARY_FEED
+#define FEED_FORMAT "bin"
+#else
+#define FEED_FORMAT "json"
+#endif /* CONFIG_BINARY_FEED */
 /* clang-format off */
 #define RELAY_ENDPOINT_URL        \
     "http://" RELAY_ENDPOINT_HOST \
@@ -55,52 +92,73 @@
     RELAY_ENDPOINT_API            \
     "?valid="  VALID_TAGS_ONLY    \
     "&num="    STR(NUM_TAGS)      \
-    "&offset=" ROTATE_TAGS
+    "&offset=" ROTATE_TAGS        \
+    "&format=" FEED_FORMAT        \
+    "&relay="
 /* clang-format on */
-#define BLE_ADVERTISEMENT_INTERVAL CONFIG_BLE_ADVERTISEMENT_INTERVAL
-#define BLE_ADVERTISEMENT_DURATION CONFIG_BLE_ADVERTISEMENT_DURATION
+#if CONFIG_COVERAGE_REPORT
+/* Interval (in us) between coverage reports */
+#define COVERAGE_REPORT_INTERVAL (CONFIG_COVERAGE_REPORT_INTERVAL * 1000000LL)
+/* clang-format off */
+#define COVERAGE_ENDPOINT_URL     \
+    "http://" RELAY_ENDPOINT_HOST \
+    ":" STR(RELAY_ENDPOINT_PORT)  \
+    "/api/v1/coverage"            \
+    "?relay="
+/* clang-format on */
+#endif /* CONFIG_COVERAGE_REPORT */
+/* Length of a MAC address formatted with MACSTR */
+#define MAC_STR_LEN 17
 
 static const char *const TAG = "RELAY-FW";
 
 static EventGroupHandle_t wifi_event_group = NULL;
-static SemaphoreHandle_t  ble_sem = NULL, airtag_mutex = NULL;
 
-/* List of AirTags we're gonna parse the JSON response from the server into */
-static struct airtag_t airtag_list[NUM_TAGS] = {0};
-static int             airtag_count          = 0;
+#if CONFIG_TAGSTORE
+/* Whether the tag store is available, otherwise tags are only held in RAM */
+static bool store_ready = false;
+#endif /* CONFIG_TAGSTORE */
+
+/* State of a single tag download, shared between the HTTP client task and the
+ * HTTP event handler (which runs in the context of the HTTP client task) */
+struct download_t {
+    bool                binary;
+    bool                delta;
+    uint64_t            version;
+    /* Time (in ms) the server asked to wait before polling again, 0 for none */
+    uint32_t            poll_after;
+    struct jsonstream_t stream;
+    struct tagfeed_t    feed;
+    struct tagtable_t  *table;
+#if CONFIG_TAGSTORE
+    /* Whether the download can't be stored and must be repeated in full */
+    bool failed;
+#endif /* CONFIG_TAGSTORE */
+};
+
+/* The AirTag object most recently parsed from the download stream */
+static struct airtag_t parsed_airtag = {0};
 
-/* Parsing definitions for microjson, mapping the JSON objects to our list of
- * AirTag structs */
+/* Parsing definitions for microjson, mapping a single JSON object of the
+ * download stream to our AirTag struct */
 static const struct json_attr_t airtag_attrs[] = {
-    {"data", t_string, STRUCTOBJECT(struct airtag_t, data),
-     .len = sizeof(airtag_list[0].data)},
-    {"valid", t_boolean, STRUCTOBJECT(struct airtag_t, valid),
-     .len = sizeof(airtag_list[0].valid)},
-    {"id", t_integer, STRUCTOBJECT(struct airtag_t, id),
-     .len = sizeof(airtag_list[0].id)},
+    {"data", t_string, .addr.string = parsed_airtag.data,
+     .len = sizeof(parsed_airtag.data)},
+    {"valid", t_boolean, .addr.boolean = &parsed_airtag.valid,
+     .len = sizeof(parsed_airtag.valid)},
+    {"id", t_uinteger, .addr.uinteger = (unsigned int *)&parsed_airtag.id,
+     .len = sizeof(parsed_airtag.id)},
+    {"valid_until", t_uinteger,
+     .addr.uinteger = (unsigned int *)&parsed_airtag.valid_to,
+     .len           = sizeof(parsed_airtag.valid_to)},
+    {"weight", t_uinteger,
+     .addr.uinteger = (unsigned int *)&parsed_airtag.weight,
+     .len = sizeof(parsed_airtag.weight), .dflt.uinteger = 1},
     {"valid_for", t_ignore, .addr = {0}},
     {"valid_from", t_ignore, .addr = {0}},
     {"valid_to", t_ignore, .addr = {0}},
     {NULL},
 };
-static const struct json_array_t airtag_array = {
-    .element_type        = t_structobject,
-    .arr.objects.base    = (char *)&airtag_list,
-    .arr.objects.stride  = sizeof(airtag_list[0]),
-    .arr.objects.subtype = airtag_attrs,
-    .count               = &airtag_count,
-    .maxlen              = sizeof(airtag_list) / sizeof(airtag_list[0]),
-};
-
-/* BLE advertisement parameters */
-static esp_ble_adv_params_t adv_params = {
-    .adv_int_min = BLE_ADVERTISEMENT_INTERVAL
-                   / 0.625, /* Interval (in ms) = interval * 0.625 */
-    .adv_int_max   = BLE_ADVERTISEMENT_INTERVAL / 0.625,
-    .adv_type      = ADV_TYPE_IND,
-    .own_addr_type = BLE_ADDR_TYPE_RANDOM,
-    .channel_map   = ADV_CHNL_ALL,
-};
 
 /**
  * @brief Handle WiFi events.
@@ -154,23 +212,50 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
  * @return esp_err_t An ESP status code.
  */
 static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
-    static size_t buffer_len = 0;
+    struct download_t *download = (struct download_t *)evt->user_data;
 
     switch (evt->event_id) {
         case HTTP_EVENT_ERROR: {
             ESP_LOGE(TAG, "HTTP error event received");
             return ESP_FAIL;
         }
-        case HTTP_EVENT_ON_DATA: {
-            size_t copy_len = MIN(evt->data_len, HTTP_BUFFER_SIZE - buffer_len);
-            memcpy(evt->user_data + buffer_len, evt->data, copy_len);
-            buffer_len += copy_len;
+        case HTTP_EVENT_ON_HEADER: {
+            /* The server may not support the binary feed, so decide on the
+             * decoder based on what it actually sends */
+            if (strcasecmp(evt->header_key, "Content-Type") == 0) {
+                download->binary =
+                    strncmp(evt->header_value, TAGFEED_CONTENT_TYPE,
+                            strlen(TAGFEED_CONTENT_TYPE))
+                    == 0;
+            } else if (strcasecmp(evt->header_key, "X-Tag-Version") == 0) {
+                download->version = strtoull(evt->header_value, NULL, 10);
+            } else if (strcasecmp(evt->header_key, "X-Tag-Delta") == 0) {
+                download->delta = true;
+            } else if (strcasecmp(evt->header_key, "X-Poll-After") == 0) {
+                download->poll_after = strtoul(evt->header_value, NULL, 10);
+            } else if (strcasecmp(evt->header_key, "X-Tag-Policy") == 0) {
+                tagsched_policy_e policy;
+                if (tagsched_policy_from_str(evt->header_value, &policy)) {
+                    tagsched_set_policy(policy);
+                } else {
+                    ESP_LOGW(TAG, "Unknown scheduling policy %s",
+                             evt->header_value);
+                }
+            }
             return ESP_OK;
         }
-        case HTTP_EVENT_ON_FINISH: /* fall-through */
-            __attribute__((fallthrough));
-        case HTTP_EVENT_DISCONNECTED: {
-            buffer_len = 0;
+        case HTTP_EVENT_ON_DATA: {
+            metrics_count(METRIC_FETCH_BYTES, evt->data_len);
+            if (esp_http_client_get_status_code(evt->client) != 200) {
+                /* Don't try to parse error pages */
+                return ESP_OK;
+            }
+            if (download->binary) {
+                tagfeed_feed(&download->feed, evt->data, evt->data_len);
+            } else {
+                ESP_LOGV(TAG, "%.*s", evt->data_len, (char *)evt->data);
+                jsonstream_feed(&download->stream, evt->data, evt->data_len);
+            }
             return ESP_OK;
         }
         default: {
@@ -181,64 +266,365 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     __builtin_unreachable();
 }
 
+#if CONFIG_TAGSTORE
+/**
+ * @brief Append a tag to the snapshot being written, skipping it if the tag
+ * store is full.
+ *
+ * @param adv Pointer to the advertisement to append.
+ *
+ * @return esp_err_t An ESP status code.
+ */
+static esp_err_t download_store(const struct airtag_adv_t *adv) {
+    esp_err_t err = tagstore_append(adv);
+
+    if (err == ESP_ERR_NO_MEM) {
+        ESP_LOGW(TAG, "Tag store full, skipping AirTag %" PRIu32, adv->id);
+        metrics_count(METRIC_TAGS_DROPPED, 1);
+        return ESP_OK;
+    }
+
+    return err;
+}
+
 /**
- * @brief Handle BLE events.
+ * @brief Collect a decoded advertisement for the tag store.
  *
- * The handler is responsible for reacting to BLE events (e.g., advertisement
- * address/data set, advertisements started/stopped).
- * The purpose of the handler is to signal to the BLE task (that is blocked
- * until a certain event occurs) to continue. This behavior synchronizes the
- * software commands with the hardware.
+ * A full tag set is streamed into a new snapshot right away, changes to the
+ * tag set are streamed into a segment appended to the latest snapshot. Expired
+ * tags are collected as tombstones with a weight of 0, which decoded tags never
+ * have.
  *
- * @param event Enum value denoting the event type.
- * @param param A pointer to additional data associated with an event..
+ * @param download Pointer to the download's state.
+ * @param adv      Pointer to the decoded advertisement (or tombstone).
  */
-static void ble_gap_event_handler(esp_gap_ble_cb_event_t  event,
-                                  esp_ble_gap_cb_param_t *param) {
-    ESP_LOGD("BLE", "In event handler");
-    if (ble_sem == NULL) {
-        /* Semaphore hasn't been set up yet */
+static void download_collect(struct download_t         *download,
+                             const struct airtag_adv_t *adv) {
+    if (download->table == NULL) {
+        /* Get hold of the table of the previous snapshot first, so the reader
+         * is done with it once the new snapshot overwrites it */
+        download->table = tagtable_begin();
+        esp_err_t err =
+            download->delta ? tagstore_begin_update() : tagstore_begin();
+        if (err != ESP_OK) {
+            download->failed = true;
+        }
+    }
+    if (download->failed) {
         return;
     }
-    switch (event) {
-        case ESP_GAP_BLE_SET_STATIC_RAND_ADDR_EVT:
-            __attribute__((fallthrough));
-        case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
-            __attribute__((fallthrough));
-        case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
-            __attribute__((fallthrough));
-        case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT: {
-            /* Let the firmware (which is waiting on the semaphore) continue */
-            xSemaphoreGive(ble_sem);
-            break;
+
+    if (download->delta) {
+        if (tagstore_append(adv) != ESP_OK) {
+            ESP_LOGW(TAG, "Could not store changes, fetching full tag set");
+            download->failed = true;
         }
-        default: {
-            break;
+    } else if (download_store(adv) != ESP_OK) {
+        download->failed = true;
+    }
+}
+
+/**
+ * @brief Store the tags of a successful download in flash and publish them.
+ *
+ * A full tag set was already streamed into a new snapshot, changes to the tag
+ * set into a segment of the latest snapshot. Either way, the advertiser reads
+ * the tags right from the (memory-mapped) snapshot.
+ *
+ * @param download Pointer to the download's state.
+ * @param complete Whether the whole response was received.
+ *
+ * @return bool true if the tags were published, false if the download has to
+ *              be repeated with the full tag set.
+ */
+static bool download_commit(struct download_t *download, bool complete) {
+    struct tagstore_view_t view = {0};
+    esp_err_t              err  = ESP_OK;
+
+    if (!complete || download->failed) {
+        ESP_LOGW(TAG, "Could not store download, keeping the stored tags");
+        tagstore_abort();
+        return false;
+    }
+
+    if (download->table == NULL && download->delta) {
+        /* No (decodable) changes */
+        return true;
+    } else if (download->table == NULL) {
+        /* Server doesn't have any (decodable) tags for us */
+        download->table = tagtable_begin();
+        err             = tagstore_begin();
+    }
+    if (err == ESP_OK) {
+        err = tagstore_commit(&view);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not store tags: %s", esp_err_to_name(err));
+        tagstore_abort();
+        return false;
+    }
+
+    tagtable_set_view(download->table, view.tags, view.count);
+    tagtable_publish(download->table);
+
+    return true;
+}
+#endif /* CONFIG_TAGSTORE */
+
+/**
+ * @brief Append a decoded advertisement to the download's table.
+ *
+ * For a full tag set, the table is published as soon as it holds its first
+ * tag, so the advertiser can start with the new tags before the download
+ * finishes. Changes to the tag set are applied to a copy of the current table
+ * instead, which is published once the download is complete.
+ *
+ * @param download Pointer to the download's state.
+ * @param adv      Pointer to the decoded advertisement.
+ */
+static void download_append(struct download_t         *download,
+                            const struct airtag_adv_t *adv) {
+    bool appended = true;
+
+#if CONFIG_TAGSTORE
+    if (store_ready) {
+        download_collect(download, adv);
+        return;
+    }
+#endif /* CONFIG_TAGSTORE */
+
+    if (download->delta) {
+        if (download->table == NULL) {
+            download->table = tagtable_begin_update();
         }
+        appended = tagtable_upsert(download->table, adv);
+    } else if (download->table == NULL) {
+        /* First tag of this download => switch the advertiser over */
+        download->table = tagtable_begin();
+        appended        = tagtable_append(download->table, adv);
+        tagtable_publish(download->table);
+    } else {
+        appended = tagtable_append(download->table, adv);
+    }
+
+    if (!appended) {
+        ESP_LOGW(TAG, "Tag table full, skipping AirTag %" PRIu32, adv->id);
+        metrics_count(METRIC_TAGS_DROPPED, 1);
     }
 }
 
+/**
+ * @brief Remove an expired AirTag from the download's table.
+ *
+ * Only changes to the tag set contain expired tags, a full tag set simply
+ * doesn't contain them anymore.
+ *
+ * @param download Pointer to the download's state.
+ * @param id       ID of the expired AirTag.
+ */
+static void download_remove(struct download_t *download, uint32_t id) {
+    if (!download->delta) {
+        return;
+    }
+#if CONFIG_TAGSTORE
+    if (store_ready) {
+        const struct airtag_adv_t tombstone = {.id = id, .weight = 0};
+        download_collect(download, &tombstone);
+        return;
+    }
+#endif /* CONFIG_TAGSTORE */
+    if (download->table == NULL) {
+        download->table = tagtable_begin_update();
+    }
+    tagtable_remove(download->table, id);
+}
+
+/**
+ * @brief Handle a single AirTag object of the JSON download stream.
+ *
+ * The callback parses the object, decodes it into a BLE advertisement, and
+ * adds it to (or removes it from) the download's table.
+ *
+ * @param object NUL-terminated JSON text of the object.
+ * @param arg    Pointer to the download's state.
+ */
+static void airtag_parsed(const char *object, void *arg) {
+    struct download_t  *download    = (struct download_t *)arg;
+    struct airtag_adv_t adv         = {0};
+    char                buffer[256] = {0};
+
+    int64_t start  = esp_timer_get_time();
+    int     status = json_read_object(object, airtag_attrs, NULL);
+    metrics_observe(METRIC_PARSE_TIME, esp_timer_get_time() - start);
+    if (status != 0) {
+        ESP_LOGW(TAG, "Could not parse AirTag object: %s",
+                 json_error_string(status));
+        return;
+    }
+
+    /* Log the received AirTag for debugging purposes */
+    airtag_to_str(&parsed_airtag, buffer, sizeof(buffer));
+    ESP_LOGI(TAG, "%s", buffer);
+
+    if (download->delta && !parsed_airtag.valid) {
+        download_remove(download, parsed_airtag.id);
+        return;
+    }
+
+    if (airtag_to_adv(&parsed_airtag, &adv) != SUCCESS) {
+        ESP_LOGW(TAG,
+                 "Could not extract advertisement information from "
+                 "downloaded AirTag %" PRIu32 " payload, skipping",
+                 parsed_airtag.id);
+        metrics_count(METRIC_TAGS_SKIPPED, 1);
+        return;
+    }
+
+    download_append(download, &adv);
+}
+
+/**
+ * @brief Handle a single record of the binary download stream.
+ *
+ * The record already contains the decoded BLE advertisement, so the callback
+ * only needs to add it to (or remove it from) the download's table.
+ *
+ * @param record Pointer to the decoded record.
+ * @param arg    Pointer to the download's state.
+ */
+static void record_decoded(const struct tagfeed_record_t *record, void *arg) {
+    struct download_t *download = (struct download_t *)arg;
+
+    ESP_LOGI(TAG, "AirTag %" PRIu32 ": valid until %" PRIu32 ", weight %u",
+             record->adv.id, record->adv.valid_to, record->adv.weight);
+    if (record->adv.valid_to == 0) {
+        download_remove(download, record->adv.id);
+    } else {
+        download_append(download, &record->adv);
+    }
+}
+
+/**
+ * @brief Publish the tags of a successful download.
+ *
+ * @param download Pointer to the download's state.
+ * @param complete Whether the whole response was received.
+ *
+ * @return bool true if the tags were published, false if the download has to
+ *              be repeated with the full tag set.
+ */
+static bool download_finish(struct download_t *download, bool complete) {
+#if CONFIG_TAGSTORE
+    if (store_ready) {
+        return download_commit(download, complete);
+    }
+#endif /* CONFIG_TAGSTORE */
+
+    if (download->delta && !complete) {
+        /* Some of the changes are missing, and later changes only start after
+         * the version of this download */
+        ESP_LOGW(TAG, "Incomplete changes, fetching full tag set");
+        return false;
+    } else if (download->delta) {
+        /* Changes are only published once all of them are applied */
+        if (download->table != NULL) {
+            tagtable_publish(download->table);
+        }
+    } else if (download->table == NULL) {
+        /* Server doesn't have any (decodable) tags for us */
+        tagtable_publish(tagtable_begin());
+    }
+
+    return true;
+}
+
+#if CONFIG_COVERAGE_REPORT
+/**
+ * @brief Report the air time of the tags since the last report to the server.
+ *
+ * The report is sent with the client of the downloads, which is set up for
+ * downloading again afterwards. The air time of a failed report is lost.
+ *
+ * @param client     The HTTP client.
+ * @param report_url URL of the coverage endpoint, identifying this relay.
+ * @param relay_url  URL to download the tags from.
+ */
+static void coverage_report(esp_http_client_handle_t client,
+                            const char *report_url, const char *relay_url) {
+    static uint8_t report[TAGREPORT_MAX_LEN] = {0};
+
+    size_t len = tagreport_take(report, sizeof(report),
+                                CONFIG_BLE_ADVERTISEMENT_DURATION);
+
+    esp_http_client_set_url(client, report_url);
+    esp_http_client_set_method(client, HTTP_METHOD_POST);
+    esp_http_client_set_header(client, "Content-Type", TAGREPORT_CONTENT_TYPE);
+    esp_http_client_set_post_field(client, (const char *)report, len);
+    metrics_count(METRIC_REPORTS, 1);
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Coverage report failed: %s", esp_err_to_name(err));
+        metrics_count(METRIC_REPORT_ERRORS, 1);
+    } else if (esp_http_client_get_status_code(client) >= 300) {
+        ESP_LOGW(TAG, "Coverage report rejected with status %d",
+                 esp_http_client_get_status_code(client));
+        metrics_count(METRIC_REPORT_ERRORS, 1);
+    }
+
+    esp_http_client_set_post_field(client, NULL, 0);
+    esp_http_client_set_method(client, HTTP_METHOD_GET);
+    esp_http_client_set_url(client, relay_url);
+}
+#endif /* CONFIG_COVERAGE_REPORT */
+
 /**
  * @brief The FreeRTOS HTTP client and AirTag parser task.
  *
  * This task downloads AirTag data from the signalling server via HTTP.
- * The downloaded data is in JSON format, which this task also parses into
- * internal structures.
+ * The downloaded data is either in JSON format or in the binary tag feed
+ * format, which this task parses and decodes into the table of BLE
+ * advertisements while it is streaming in.
  *
  * @param params (unused, required for task function prototype)
  */
 static void http_client_task(void *params) {
+    /* MAC address identifying this relay to the server */
+    uint8_t mac[6] = {0};
+    char    relay_url[sizeof(RELAY_ENDPOINT_URL) + MAC_STR_LEN] = {0};
+
     /* Set up and configure HTTP client */
-    char                     http_buffer[HTTP_BUFFER_SIZE + 1] = {0};
-    esp_http_client_config_t http_config                       = {
-                              .url                   = RELAY_ENDPOINT_URL,
-                              .method                = HTTP_METHOD_GET,
-                              .disable_auto_redirect = false,
-                              .event_handler         = &http_event_handler,
-                              .user_data             = http_buffer,
+    char                     object_buffer[HTTP_BUFFER_SIZE] = {0};
+    struct download_t        download                        = {0};
+    esp_http_client_config_t http_config                     = {
+                            .url                   = relay_url,
+                            .method                = HTTP_METHOD_GET,
+                            .disable_auto_redirect = false,
+                            .event_handler         = &http_event_handler,
+                            .user_data             = &download,
+                            .timeout_ms            = HTTP_TIMEOUT_MS,
     };
 
-    ESP_LOGI(TAG, "Client connecting to " RELAY_ENDPOINT_URL);
+#if CONFIG_DELTA_SYNC
+    /* Change version of the tag set we hold, 0 for none */
+    uint64_t since = 0;
+    char     url[sizeof(relay_url) + sizeof(SINCE_QUERY) + 20] = {0};
+#endif /* CONFIG_DELTA_SYNC */
+#if CONFIG_COVERAGE_REPORT
+    char report_url[sizeof(COVERAGE_ENDPOINT_URL) + MAC_STR_LEN] = {0};
+
+    int64_t next_report = esp_timer_get_time() + COVERAGE_REPORT_INTERVAL;
+#endif /* CONFIG_COVERAGE_REPORT */
+
+    /* The server rotates through the tags for every relay separately */
+    ESP_ERROR_CHECK(esp_read_mac(mac, ESP_MAC_WIFI_STA));
+    snprintf(relay_url, sizeof(relay_url), RELAY_ENDPOINT_URL MACSTR,
+             MAC2STR(mac));
+#if CONFIG_COVERAGE_REPORT
+    snprintf(report_url, sizeof(report_url), COVERAGE_ENDPOINT_URL MACSTR,
+             MAC2STR(mac));
+#endif /* CONFIG_COVERAGE_REPORT */
+
+    ESP_LOGI(TAG, "Client connecting to %s", relay_url);
     esp_http_client_handle_t client = esp_http_client_init(&http_config);
     if (client == NULL) {
         ESP_LOGE(TAG, "HTTP client initialization failed, rebooting");
@@ -249,99 +635,101 @@ static void http_client_task(void *params) {
 
     /* Actually perform the requests in a loop */
     for (;;) {
-        /* Retrieve tags from server */
+#if CONFIG_LONG_POLL
+        /* Whether we're in sync with the server's tag set, so we can
+         * long-poll for further changes right away */
+        bool synced = false;
+#endif /* CONFIG_LONG_POLL */
+
+        /* Retrieve tags from server, they are parsed and published while
+         * the response streams in */
+        jsonstream_init(&download.stream, object_buffer, sizeof(object_buffer),
+                        airtag_parsed, &download);
+        tagfeed_init(&download.feed, record_decoded, &download);
+        download.binary     = false;
+        download.delta      = false;
+        download.version    = 0;
+        download.poll_after = 0;
+        download.table      = NULL;
+#if CONFIG_TAGSTORE
+        download.failed = false;
+#endif /* CONFIG_TAGSTORE */
+#if CONFIG_DELTA_SYNC
+        if (since > 0) {
+            /* Only ask for the changes to the tag set we hold */
+            snprintf(url, sizeof(url), "%s" SINCE_QUERY "%" PRIu64, relay_url,
+                     since);
+            esp_http_client_set_url(client, url);
+        } else {
+            esp_http_client_set_url(client, relay_url);
+        }
+#endif /* CONFIG_DELTA_SYNC */
+        int64_t start = esp_timer_get_time();
+        metrics_count(METRIC_FETCHES, 1);
         esp_err_t err = esp_http_client_perform(client);
+        metrics_observe(METRIC_FETCH_LATENCY, esp_timer_get_time() - start);
         if (err == ESP_OK) {
+            int status = esp_http_client_get_status_code(client);
             ESP_LOGI(TAG, "HTTP GET Status = %d, content_length = %" PRId64,
-                     esp_http_client_get_status_code(client),
-                     esp_http_client_get_content_length(client));
+                     status, esp_http_client_get_content_length(client));
+            if (status != 200 && status != 304) {
+                metrics_count(METRIC_FETCH_ERRORS, 1);
+            } else if (status == 200
+                       && !download_finish(
+                           &download,
+                           esp_http_client_is_complete_data_received(client))) {
+                /* Start over with the full tag set */
+                metrics_count(METRIC_FETCH_ERRORS, 1);
+                download.version = 0;
+            }
+#if CONFIG_DELTA_SYNC
+            if (status == 200 || status == 304) {
+#if CONFIG_LONG_POLL
+                synced = download.version > 0;
+#endif /* CONFIG_LONG_POLL */
+                since = download.version;
+            }
+#endif /* CONFIG_DELTA_SYNC */
         } else {
             ESP_LOGE(TAG, "HTTP GET request failed: %s", esp_err_to_name(err));
+            metrics_count(METRIC_FETCH_ERRORS, 1);
+            if (xEventGroupGetBits(wifi_event_group) & WIFI_FAIL_BIT) {
+                /* Out of reconnection attempts, start over */
+                xEventGroupClearBits(wifi_event_group, WIFI_FAIL_BIT);
+                esp_wifi_connect();
+            }
         }
-
-        xSemaphoreTake(airtag_mutex, portMAX_DELAY);
-        /* Parse tags */
-        int status = json_read_array(http_buffer, &airtag_array, NULL);
-        ESP_LOGD(TAG, "JSON parse status: %d", status);
-
-        ESP_LOGV(TAG, "%s", http_buffer);
-
-        /* Log the received AirTags for debugging purposes */
-        const size_t buffer_len = 256;
-        char        *buffer     = (char *)calloc(1, buffer_len);
-        for (int i = 0; i < airtag_count; i++) {
-            airtag_to_str(&airtag_list[i], buffer, buffer_len);
-            ESP_LOGI(TAG, "%s", buffer);
-            memset(buffer, 0, buffer_len);
+        if (download.stream.dropped > 0) {
+            ESP_LOGW(TAG, "Dropped %u oversized AirTag objects",
+                     download.stream.dropped);
         }
-        free(buffer);
-        xSemaphoreGive(airtag_mutex);
-
-        /* Wait for a bit before we download the next batch of Airtags */
-        vTaskDelay(RELAY_DOWNLOAD_INTERVAL / portTICK_PERIOD_MS);
-    }
-
-    /* Cannot arrive here due to infinite loop above */
-    __builtin_unreachable();
-}
-
-/**
- * @brief The FreeRTOS BLE advertisement task.
- *
- * This task extracts address and payload from the downloaded AirTag data and
- * configures the BLE peripheral to advertise the data accordingly.
- *
- * @param params (unused, required for task function prototype)
- */
-static void ble_adv_task(void *params) {
-    int index = 0;
 
-    assert(sizeof(esp_bd_addr_t) >= ADDR_LEN);
-    for (;;) {
-        if (airtag_count <= 0) {
-            /* No AirTags available => spin and wait */
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            continue;
+#if CONFIG_COVERAGE_REPORT
+        if (esp_timer_get_time() >= next_report) {
+            coverage_report(client, report_url, relay_url);
+            next_report = esp_timer_get_time() + COVERAGE_REPORT_INTERVAL;
         }
-        /* First, retrieve payload/address from raw AirTag data */
-        esp_bd_addr_t addr                 = {0};
-        uint8_t       payload[PAYLOAD_LEN] = {0};
-
-        xSemaphoreTake(airtag_mutex, portMAX_DELAY);
-
-        /* Index should always be lower due to the modulo operation when
-         * updating it */
-        assert(index < airtag_count);
-
-        if (airtag_to_ble_advertisement(&airtag_list[index], addr, payload)
-            != SUCCESS) {
-            ESP_LOGW(TAG,
-                     "Could not extract advertisement information from "
-                     "downloaded AirTag payload, skipping");
-            xSemaphoreGive(airtag_mutex);
+#endif /* CONFIG_COVERAGE_REPORT */
+
+#if CONFIG_LONG_POLL
+        if (synced) {
+            /* The server holds the next request until there are changes (or
+             * the long-poll timeout expires), so ask right away */
             continue;
         }
-        index = (index + 1) % airtag_count;
-
-        xSemaphoreGive(airtag_mutex);
-
-        /* Then, actually set the BLE address and advertisement payload */
-        ESP_ERROR_CHECK(esp_ble_gap_set_rand_addr(addr));
-        xSemaphoreTake(ble_sem, portMAX_DELAY);
-        ESP_ERROR_CHECK(
-            esp_ble_gap_config_adv_data_raw(payload, sizeof(payload)));
-        xSemaphoreTake(ble_sem, portMAX_DELAY);
-
-        /* Finally, start advertising */
-        ESP_ERROR_CHECK(esp_ble_gap_start_advertising(&adv_params));
-        xSemaphoreTake(ble_sem, portMAX_DELAY);
+#endif /* CONFIG_LONG_POLL */
 
-        /* Wait for a bit before we continue with the next AirTag */
-        vTaskDelay(BLE_ADVERTISEMENT_DURATION / portTICK_PERIOD_MS);
-
-        /* Stop advertising */
-        ESP_ERROR_CHECK(esp_ble_gap_stop_advertising());
-        xSemaphoreTake(ble_sem, portMAX_DELAY);
+        /* Wait for a bit before we download the next batch of Airtags */
+        uint32_t interval = RELAY_DOWNLOAD_INTERVAL;
+#if CONFIG_ADAPTIVE_POLL
+        if (err == ESP_OK && download.poll_after > 0) {
+            /* The server knows best how often it's worth asking */
+            interval = MIN(MAX(download.poll_after, ADAPTIVE_POLL_MIN_INTERVAL),
+                           ADAPTIVE_POLL_MAX_INTERVAL);
+            ESP_LOGI(TAG, "Polling again in %" PRIu32 " ms", interval);
+        }
+#endif /* CONFIG_ADAPTIVE_POLL */
+        vTaskDelay(interval / portTICK_PERIOD_MS);
     }
 
     /* Cannot arrive here due to infinite loop above */
@@ -355,7 +743,40 @@ static void ble_adv_task(void *params) {
  * the RTOS are initialized.
  */
 void app_main(void) {
-    ESP_LOGI(TAG, "Relay Firmware starting, configuring WiFi...");
+    ESP_LOGI(TAG, "Relay Firmware starting...");
+
+#if CONFIG_TAGSTORE
+    /* Advertise the stored tags right away, without waiting for the server */
+    struct tagstore_view_t view = {0};
+    store_ready                 = tagstore_init() == ESP_OK;
+    if (store_ready && tagstore_get(&view)) {
+        struct tagtable_t *table = tagtable_begin();
+        tagtable_set_view(table, view.tags, view.count);
+        tagtable_publish(table);
+    }
+#endif /* CONFIG_TAGSTORE */
+
+    /* Reset and set up BLE controller */
+    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_bt_controller_init(&bt_cfg));
+    ESP_ERROR_CHECK(esp_bt_controller_enable(ESP_BT_MODE_BLE));
+    /* Set up BLE host stack */
+    esp_bluedroid_config_t bluedroid_cfg = BT_BLUEDROID_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_bluedroid_init_with_cfg(&bluedroid_cfg));
+    ESP_ERROR_CHECK(esp_bluedroid_enable());
+    /* Set up the advertiser on top of it */
+    if (advertiser_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Advertiser couldn't be initialized");
+        esp_restart();
+    }
+
+    /* Start the BLE advertiser */
+    TaskHandle_t advertiser = NULL;
+    xTaskCreate(advertiser_task, "BLE Advertiser", 4096, NULL, 2, &advertiser);
+    metrics_track_task(advertiser);
+
+    ESP_LOGI(TAG, "Advertiser started, configuring WiFi...");
 
     /* Initialize and configure the lwIP stack and the WiFi driver */
     ESP_ERROR_CHECK(esp_netif_init());
@@ -400,6 +821,18 @@ void app_main(void) {
     EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
                                            WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
                                            pdFALSE, pdFALSE, portMAX_DELAY);
+#if CONFIG_TAGSTORE
+    while (store_ready && (bits & WIFI_FAIL_BIT)) {
+        /* Keep advertising the stored tags while retrying */
+        ESP_LOGW(TAG, "Failed to connect to AP, retrying");
+        vTaskDelay(RELAY_DOWNLOAD_INTERVAL / portTICK_PERIOD_MS);
+        xEventGroupClearBits(wifi_event_group, WIFI_FAIL_BIT);
+        esp_wifi_connect();
+        bits = xEventGroupWaitBits(wifi_event_group,
+                                   WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE,
+                                   pdFALSE, portMAX_DELAY);
+    }
+#endif /* CONFIG_TAGSTORE */
 
     if (bits & WIFI_CONNECTED_BIT) {
         ESP_LOGI(TAG, "Connected to AP");
@@ -411,31 +844,15 @@ void app_main(void) {
         esp_restart();
     }
 
-    /* Reset and set up BLE controller */
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
-    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_bt_controller_init(&bt_cfg));
-    ESP_ERROR_CHECK(esp_bt_controller_enable(ESP_BT_MODE_BLE));
-    /* Set up BLE host stack */
-    esp_bluedroid_config_t bluedroid_cfg = BT_BLUEDROID_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_bluedroid_init_with_cfg(&bluedroid_cfg));
-    ESP_ERROR_CHECK(esp_bluedroid_enable());
-    /* Add event handler that signals the BLE task to continue on events */
-    ESP_ERROR_CHECK(esp_ble_gap_register_callback(ble_gap_event_handler));
-
-    /* Initialize mutexes/semaphores */
-    if ((ble_sem = xSemaphoreCreateBinary()) == NULL) {
-        ESP_LOGE(TAG, "Semaphore couldn't be initialized");
-        esp_restart();
-    }
-    if ((airtag_mutex = xSemaphoreCreateMutex()) == NULL) {
-        ESP_LOGE(TAG, "Mutex couldn't be initialized");
-        esp_restart();
+#if CONFIG_METRICS
+    /* Start serving the metrics */
+    if (metrics_server_start(METRICS_PORT) != ESP_OK) {
+        ESP_LOGW(TAG, "Metrics server couldn't be started");
     }
+#endif /* CONFIG_METRICS */
 
     /* Start the HTTP client */
-    xTaskCreate(http_client_task, "HTTP Client", 8192, NULL, 2, NULL);
-
-    /* Start the BLE advertiser */
-    xTaskCreate(ble_adv_task, "BLE Advertiser", 4096, NULL, 2, NULL);
+    TaskHandle_t http_client = NULL;
+    xTaskCreate(http_client_task, "HTTP Client", 8192, NULL, 2, &http_client);
+    metrics_track_task(http_client);
 }
@@ -0,0 +1,432 @@
+#!/usr/bin/env python3
+
+import argparse
+import http.client
+import json
+import logging
+import os
+import random
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import urllib.parse
+
+from typing import Dict, Tuple, List, Any
+
+# Logging
+logging.basicConfig()
+log = logging.getLogger(__name__)
+log.setLevel(logging.WARNING)
+
+# Fixed start of an AirTag advertisement body (see AirTag.advertisement_template)
+ADV_PREFIX = bytes.fromhex("1eff4c00121910")
+PDU_HEADER = bytes.fromhex("4225")  # ADV_NONCONN_IND, random address, 37 bytes
+MAX_BATCH = 10000  # maximum number of tags per batch request of the server
+
+
+def advertisement(rng: random.Random, with_header: bool = False) -> bytes:
+    """Generates a synthetic AirTag advertisement
+
+    The layout is the one AirTag.extract_key_from_packet expects: the BLE
+    address (in reverse order) followed by the 31 byte advertisement body,
+    optionally preceded by the two byte PDU header.
+
+    Args:
+        rng: random number generator to draw the public key from
+        with_header: whether to generate the 39 byte variant with the header
+
+    Returns:
+        bytes: the advertisement
+    """
+    key = rng.randbytes(28)
+    addr = bytearray(key[:6])
+    addr[0] |= 0b11000000
+    body = ADV_PREFIX + key[6:28] + bytes([key[0] >> 6, 0])
+    return (PDU_HEADER if with_header else b"") + bytes(addr[::-1]) + body
+
+
+class Endpoint:
+    """Latencies and errors of the requests to one endpoint
+
+    Attributes:
+        latencies (List[float]): latencies (in s) of the successful requests
+        errors (int): number of failed requests
+    """
+
+    def __init__(self):
+        self.latencies: List[float] = []
+        self.errors: int = 0
+        self.lock = threading.Lock()
+
+    def record(self, latency: float, ok: bool):
+        with self.lock:
+            if ok:
+                self.latencies.append(latency)
+            else:
+                self.errors += 1
+
+    def summary(self, duration: float) -> Dict[str, Any]:
+        """Summarizes the requests
+
+        Args:
+            duration: duration (in s) of the benchmark
+
+        Returns:
+            Dict[str, Any]: throughput, error count, and latency percentiles
+        """
+        latencies = sorted(self.latencies)
+
+        def percentile(p: float) -> float:
+            if not latencies:
+                return None
+            return latencies[min(len(latencies) - 1, int(p * len(latencies)))] * 1e3
+
+        return {
+            "requests": len(latencies),
+            "errors": self.errors,
+            "throughput_rps": len(latencies) / duration,
+            "latency_ms": {
+                "p50": percentile(0.50),
+                "p95": percentile(0.95),
+                "p99": percentile(0.99),
+                "max": latencies[-1] * 1e3 if latencies else None,
+            },
+        }
+
+
+def request(
+    conn: http.client.HTTPConnection,
+    endpoint: Endpoint,
+    method: str,
+    path: str,
+    body: bytes = None,
+    headers: Dict[str, str] = {},
+):
+    """Sends a request and records its latency
+
+    Args:
+        conn: the (persistent) connection to the server
+        endpoint: the endpoint to record the latency for
+        method: HTTP method
+        path: path and query of the request
+        body: request body
+        headers: request headers
+    """
+    start = time.perf_counter()
+    try:
+        conn.request(method, path, body=body, headers=headers)
+        response = conn.getresponse()
+        response.read()
+        ok = response.status < 400
+    except (OSError, http.client.HTTPException) as e:
+        log.debug(f"{method} {path} failed: {e}")
+        conn.close()
+        ok = False
+    endpoint.record(time.perf_counter() - start, ok)
+
+
+def uploader(
+    host: str,
+    port: int,
+    seed: int,
+    batch: int,
+    interval: float,
+    deadline: float,
+    endpoint: Endpoint,
+):
+    """Uploads synthetic advertisements until the deadline
+
+    Args:
+        host: server host
+        port: server port
+        seed: seed of the advertisements, to make runs reproducible
+        batch: number of advertisements per request (0 for single uploads)
+        interval: time (in s) between uploads (0 to upload back to back)
+        deadline: time (from time.monotonic) at which to stop
+        endpoint: the endpoint to record the latencies for
+    """
+    rng = random.Random(seed)
+    conn = http.client.HTTPConnection(host, port, timeout=30)
+    headers = {"Content-Type": "application/octet-stream"}
+    while time.monotonic() < deadline:
+        if batch > 0:
+            body = b"".join(
+                advertisement(rng, rng.random() < 0.5) for _ in range(batch)
+            )
+            request(conn, endpoint, "POST", "/api/v1/airtags:batch", body, headers)
+        else:
+            body = advertisement(rng, rng.random() < 0.5)
+            request(conn, endpoint, "POST", "/api/v1/airtag", body, headers)
+        time.sleep(interval)
+
+
+def relay(
+    host: str,
+    port: int,
+    mac: str,
+    num: int,
+    feed_format: str,
+    interval: float,
+    deadline: float,
+    endpoint: Endpoint,
+):
+    """Polls the tags like a relay until the deadline
+
+    Args:
+        host: server host
+        port: server port
+        mac: MAC address identifying the relay
+        num: number of tags per poll
+        feed_format: "json" or "bin"
+        interval: time (in s) between polls (0 to poll back to back)
+        deadline: time (from time.monotonic) at which to stop
+        endpoint: the endpoint to record the latencies for
+    """
+    conn = http.client.HTTPConnection(host, port, timeout=30)
+    query = urllib.parse.urlencode(
+        {"valid": 1, "num": num, "offset": 1, "format": feed_format, "relay": mac}
+    )
+    while time.monotonic() < deadline:
+        request(conn, endpoint, "GET", "/api/v1/airtag/?" + query)
+        time.sleep(interval)
+
+
+def spawn_server(
+    sqlitedb: str, extra_args: List[str]
+) -> Tuple[subprocess.Popen, int]:
+    """Starts a server on a free local port
+
+    Args:
+        sqlitedb: SQLite database file for the server
+        extra_args: further command line arguments for the server
+
+    Returns:
+        Tuple[subprocess.Popen, int]: the server process and its port
+    """
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        port = s.getsockname()[1]
+    server = os.path.join(os.path.dirname(os.path.abspath(__file__)), "server.py")
+    process = subprocess.Popen(
+        [sys.executable, server, "-i", "127.0.0.1", "-p", str(port)]
+        + ["-s", sqlitedb]
+        + extra_args
+    )
+    # Wait until the server accepts connections
+    for _ in range(100):
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return process, port
+        except OSError:
+            if process.poll() is not None:
+                break
+            time.sleep(0.1)
+    process.kill()
+    raise RuntimeError("Server did not start")
+
+
+def database_size(sqlitedb: str) -> int:
+    """Returns the size of a database including its write-ahead log
+
+    Args:
+        sqlitedb: SQLite database file
+
+    Returns:
+        int: the size (in bytes), or None if the database doesn't exist
+    """
+    if sqlitedb is None or not os.path.exists(sqlitedb):
+        return None
+    return sum(
+        os.path.getsize(f)
+        for f in [sqlitedb, sqlitedb + "-wal"]
+        if os.path.exists(f)
+    )
+
+
+def git_commit() -> str:
+    """Returns the commit the benchmark runs on, if it runs in a git checkout"""
+    try:
+        return subprocess.run(
+            ["git", "rev-parse", "HEAD"],
+            cwd=os.path.dirname(os.path.abspath(__file__)),
+            capture_output=True,
+            text=True,
+            check=True,
+        ).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Load test and latency benchmark for the API server",
+        formatter_class=argparse.ArgumentDefaultsHelpFormatter,
+    )
+    parser.add_argument(
+        "-u",
+        "--url",
+        default=None,
+        help="URL of a running server to benchmark (default: spawn a server "
+        "with a fresh database)",
+    )
+    parser.add_argument(
+        "-s",
+        "--sqlitedb",
+        default=None,
+        help="SQLite database file of the server, to report its size",
+    )
+    parser.add_argument(
+        "--server-args",
+        default="",
+        help="Further command line arguments for the spawned server",
+    )
+    parser.add_argument(
+        "-d", "--duration", type=float, default=30, help="Duration (in s)"
+    )
+    parser.add_argument(
+        "--preload", type=int, default=1000, help="Tags to upload before starting"
+    )
+    parser.add_argument(
+        "--uploaders", type=int, default=4, help="Number of concurrent uploaders"
+    )
+    parser.add_argument(
+        "--batch",
+        type=int,
+        default=0,
+        help="Tags per upload via the batch endpoint (0 for single uploads)",
+    )
+    parser.add_argument(
+        "--upload-interval",
+        type=float,
+        default=0,
+        help="Time (in s) between uploads of an uploader",
+    )
+    parser.add_argument(
+        "--relays", type=int, default=16, help="Number of concurrent relays"
+    )
+    parser.add_argument("--num", type=int, default=5, help="Tags per relay poll")
+    parser.add_argument(
+        "--format", dest="feed_format", choices=["json", "bin"], default="bin"
+    )
+    parser.add_argument(
+        "--poll-interval",
+        type=float,
+        default=0,
+        help="Time (in s) between polls of a relay",
+    )
+    parser.add_argument(
+        "--seed", type=int, default=0, help="Seed of the synthetic advertisements"
+    )
+    parser.add_argument(
+        "-o",
+        "--output",
+        default="bench.json",
+        help="File to write the results to as JSON",
+    )
+    parser.add_argument(
+        "-v",
+        "--verbose",
+        dest="verbosity",
+        action="count",
+        default=0,
+        help="print verbose output. Specify multiple times for increasing verbosity",
+    )
+
+    args = parser.parse_args()
+
+    # Set log level based on given verbosity
+    verb_levels = [logging.WARNING, logging.INFO, logging.DEBUG]
+    log.setLevel(verb_levels[min(len(verb_levels) - 1, args.verbosity)])
+
+    server = None
+    sqlitedb = args.sqlitedb
+    if args.url is None:
+        tmpdir = tempfile.TemporaryDirectory()
+        sqlitedb = os.path.join(tmpdir.name, "bench.db")
+        server, port = spawn_server(sqlitedb, args.server_args.split())
+        host = "127.0.0.1"
+        log.info(f"Spawned server on port {port}")
+    else:
+        url = urllib.parse.urlsplit(args.url)
+        host, port = url.hostname, url.port or 80
+
+    try:
+        # Make sure the relays have tags to fetch
+        rng = random.Random(-1)
+        conn = http.client.HTTPConnection(host, port, timeout=60)
+        preload = Endpoint()
+        for i in range(0, args.preload, MAX_BATCH):
+            body = b"".join(
+                advertisement(rng) for _ in range(min(MAX_BATCH, args.preload - i))
+            )
+            request(
+                conn,
+                preload,
+                "POST",
+                "/api/v1/airtags:batch",
+                body,
+                {"Content-Type": "application/octet-stream"},
+            )
+        conn.close()
+        if preload.errors:
+            raise RuntimeError("Preloading tags failed")
+
+        endpoints = {"add_tag": Endpoint(), "get_tags": Endpoint()}
+        deadline = time.monotonic() + args.duration
+        threads = [
+            threading.Thread(
+                target=uploader,
+                args=(
+                    host,
+                    port,
+                    args.seed + i,
+                    args.batch,
+                    args.upload_interval,
+                    deadline,
+                    endpoints["add_tag"],
+                ),
+            )
+            for i in range(args.uploaders)
+        ] + [
+            threading.Thread(
+                target=relay,
+                args=(
+                    host,
+                    port,
+                    "02:00:00:00:%02x:%02x" % (i >> 8, i & 0xFF),
+                    args.num,
+                    args.feed_format,
+                    args.poll_interval,
+                    deadline,
+                    endpoints["get_tags"],
+                ),
+            )
+            for i in range(args.relays)
+        ]
+        start = time.monotonic()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        duration = time.monotonic() - start
+    finally:
+        if server is not None:
+            server.terminate()
+            server.wait()
+
+    results = {
+        "commit": git_commit(),
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+        "config": {k: v for k, v in vars(args).items() if k != "verbosity"},
+        "duration_s": duration,
+        "endpoints": {
+            name: endpoint.summary(duration) for name, endpoint in endpoints.items()
+        },
+        "database_bytes": database_size(sqlitedb),
+    }
+    with open(args.output, "w") as f:
+        json.dump(results, f, indent=2)
+    print(json.dumps(results["endpoints"], indent=2))
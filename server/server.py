@@ -1,22 +1,94 @@
 #!/usr/bin/env python3
 
 import argparse
+import atexit
 import base64
+import binascii
+import bisect
 import datetime
 import json
 import logging
+import math
 import multiprocessing as mp
+import os
+import queue
+import random
+import struct
 import sys
+import threading
 import time
+import zlib
 
-from sqlalchemy import create_engine, Column, Integer, String, DateTime
+from sqlalchemy import create_engine, event, inspect, text, func, and_, or_
+from sqlalchemy import Column, Index, Integer, LargeBinary, String, DateTime
+from sqlalchemy.dialects.sqlite import insert
+from sqlalchemy.engine import Engine
 from sqlalchemy.orm import DeclarativeBase, sessionmaker, Session
 
 from flask import Flask, current_app, request, Response, jsonify
-from typing import Dict, Tuple, List, Any
+from typing import Dict, FrozenSet, Tuple, List, Any, NamedTuple, Optional
 
 # Constants
 VALIDITY = datetime.timedelta(hours=24)
+MAX_WAIT = 60.0  # maximum time (in s) a long-polling request is held open
+
+# Binary tag feed format: a header (magic, format version, size of a single
+# record, number of records) followed by fixed-size records (tag ID, BLE
+# address in the order passed to the BLE stack, 31 byte advertisement body,
+# valid_to as epoch seconds or 0 if the tag is not valid, scheduling weight),
+# all little endian. Feeds of more records than the count of the header holds
+# come with the large header instead, which widens the count to 32 bits.
+FEED_MAGIC = b"PSTF"
+FEED_VERSION = 1
+FEED_HEADER = struct.Struct("<4sBBH")
+FEED_LARGE_VERSION = 2
+FEED_LARGE_HEADER = struct.Struct("<4sBBxxI")
+FEED_RECORD = struct.Struct("<I6s31sIH")
+
+# Tag scheduling policies the relays support
+POLICIES = ["round-robin", "weighted-fair", "earliest-expiry"]
+MAX_WEIGHT = 0xFFFF
+MAX_RELAY_LEN = 64  # maximum length (in bytes, UTF-8) of a relay identifier
+
+# Batch ingest
+MAX_BATCH = 10000  # maximum number of tags per batch request
+UPSERT_CHUNK = 500  # tags per upsert statement (SQLite limits the parameters)
+ADV_PREFIX = b"\x1e\xff\x4c\x00"  # start of an AirTag advertisement body
+
+# Write-behind ingest
+MAX_QUEUED = 10000  # maximum number of requests queued for the writer thread
+
+# Serving
+BUSY_TIMEOUT = 5000  # maximum time (in ms) to wait for SQLite's locks
+SNAPSHOT_REFRESH = 1.0  # time (in s) after which a worker picks up others' changes
+CURSOR_SLOTS = 4096  # number of relays whose rotation cursors are tracked
+RELAY_KEY_LEN = MAX_RELAY_LEN + 1  # length prefix and identifier of a relay
+
+# Compaction
+COMPACT_INTERVAL = 3600.0  # time (in s) between compactions
+COMPACT_BATCH = 1000  # maximum number of rows deleted per transaction
+COMPACT_PAUSE = 0.05  # time (in s) between deleting batches
+
+# Coverage reports of the relays: a header (magic, format version, size of a
+# single record, number of records, duration of an advertisement slot in ms)
+# followed by fixed-size records (tag ID, number of slots the tag was on air),
+# all little endian
+COVERAGE_MAGIC = b"PSCR"
+COVERAGE_VERSION = 1
+COVERAGE_HEADER = struct.Struct("<4sBBHI")
+COVERAGE_RECORD = struct.Struct("<IH")
+COVERAGE_PERIOD = 3600  # time (in s) for which relays keep the tags assigned
+
+# Sharding the tags across the relays
+SHARD_VNODES = 64  # points per relay on the hash ring, evening out the shards
+RELAY_TIMEOUT = 600.0  # time (in s) after its last poll a relay's shard moves on
+
+# Adaptive polling: relays are told to poll again after a share of the time the
+# tag set has been idle for, within bounds, stretched while the worker is busy
+POLL_MIN = 2.0  # minimum time (in s) between polls of a relay
+POLL_MAX = 300.0  # maximum time (in s) between polls of a relay
+POLL_BACKOFF = 0.5  # share of the idle time to wait
+POLL_JITTER = 0.2  # maximum deviation from the interval, spreading out relays
 
 # Logging
 logging.basicConfig()
@@ -27,6 +99,23 @@ log.setLevel(logging.WARNING)
 app = Flask(__name__)
 
 
+def feed_header(count: int) -> bytes:
+    """Returns the header of a binary tag feed
+
+    Args:
+        count: number of records of the feed
+
+    Returns:
+        bytes: the header, the large one only if the count requires it (so
+            relays that don't support it yet keep working)
+    """
+    if count <= 0xFFFF:
+        return FEED_HEADER.pack(FEED_MAGIC, FEED_VERSION, FEED_RECORD.size, count)
+    return FEED_LARGE_HEADER.pack(
+        FEED_MAGIC, FEED_LARGE_VERSION, FEED_RECORD.size, count
+    )
+
+
 class Base(DeclarativeBase):
     """Base class for the ORM"""
 
@@ -49,25 +138,43 @@ class AirTag(Base):
         key (bytes): the public key extracted from the BLE advertisement
         addr (bytes): the MAC address of the AirTag extracted from the public key
         body (bytes): the BLE advertisement payload extracted from the public key
+        version (int): change version of the last insert/update of the AirTag
+        weight (int): share of the air time relays give the AirTag relative to others
+
+    The key, address, and body are extracted once when the AirTag is created and
+    stored along with it, as is the part of its JSON representation that only
+    changes on updates (see to_json).
     """
 
     __tablename__ = "airtags"
     id = Column(Integer, primary_key=True)
-    _data = Column(String)
-    _valid_from = Column(DateTime)
-    _valid_to = Column(DateTime)
+    _data = Column(String, unique=True, index=True)
+    _valid_from = Column(Integer)  # epoch seconds
+    _valid_to = Column(Integer)  # epoch seconds
+    _version = Column(Integer, nullable=False, default=0, index=True)
+    _weight = Column(Integer, nullable=False, default=1)
+    _key = Column(LargeBinary)
+    _addr = Column(LargeBinary)
+    _body = Column(LargeBinary)
+    _json = Column(String)  # cached JSON fragment, see to_json
+
+    # Covers selecting (and counting) the valid tags
+    __table_args__ = (Index("ix_airtags__valid", "_valid_to", "_valid_from", "id"),)
 
     def __init__(
         self,
         data: str,
         valid_from: datetime.datetime = None,
         valid_to: datetime.datetime = None,
+        weight: int = None,
         *args,
         **kwargs,
     ):
         self.data = data
         self.valid_from = valid_from
         self.valid_to = valid_to
+        self.weight = weight
+        self._json = self.json_fragment()
 
     def __eq__(self, other):
         # Only the actual tag data is used for determining equality
@@ -100,60 +207,91 @@ class AirTag(Base):
         else:
             raise TypeError()
 
+        try:
+            adv = base64.b64decode(self._data, validate=True)
+        except binascii.Error:
+            raise ValueError("Invalid data")
+        if len(adv) < 36:
+            raise ValueError("Invalid data")
+        self._key = bytes(self.extract_key_from_packet(adv))
+        body = self.advertisement_template()
+        body[7:29] = self._key[6:28]
+        body[29] = self._key[0] >> 6
+        self._body = bytes(body)
+        addr = bytearray(self._key[:6])
+        addr[0] |= 0b11000000
+        self._addr = bytes(addr[::-1])
+
     @property
     def valid_from(self) -> datetime.datetime:
-        return self._valid_from
+        return datetime.datetime.fromtimestamp(self._valid_from)
 
     @valid_from.setter
     def valid_from(self, value):
         if value is None:
-            self._valid_from = datetime.datetime.now()
+            self._valid_from = int(time.time())
         elif isinstance(value, str):
-            self._valid_from = datetime.datetime.fromisoformat(value)
+            self._valid_from = int(datetime.datetime.fromisoformat(value).timestamp())
         elif isinstance(value, datetime.datetime):
-            self._valid_from = value
+            self._valid_from = int(value.timestamp())
         else:
             raise TypeError("Invalid datetime")
 
     @property
     def valid_to(self) -> datetime.datetime:
-        return self._valid_to
+        return datetime.datetime.fromtimestamp(self._valid_to)
 
     @valid_to.setter
     def valid_to(self, value):
         if value is None:
-            self._valid_to = self._valid_from + VALIDITY
+            self._valid_to = self._valid_from + int(VALIDITY.total_seconds())
         elif isinstance(value, str):
-            self._valid_to = datetime.datetime.fromisoformat(value)
+            self._valid_to = int(datetime.datetime.fromisoformat(value).timestamp())
         elif isinstance(value, datetime.datetime):
-            self._valid_to = value
+            self._valid_to = int(value.timestamp())
         else:
             raise TypeError("Invalid datetime")
 
+    @property
+    def version(self) -> int:
+        return self._version
+
+    @version.setter
+    def version(self, value: int):
+        self._version = value
+
+    @property
+    def weight(self) -> int:
+        return self._weight
+
+    @weight.setter
+    def weight(self, value):
+        if value is None:
+            self._weight = 1
+        elif isinstance(value, int) and 1 <= value <= MAX_WEIGHT:
+            self._weight = value
+        else:
+            raise ValueError("Invalid weight")
+
     @property
     def valid_for(self) -> datetime.timedelta:
-        return self._valid_to - self._valid_from
+        return datetime.timedelta(seconds=self._valid_to - self._valid_from)
 
     @property
     def is_valid(self) -> bool:
-        return self._valid_from < datetime.datetime.now() < self._valid_to
+        return self._valid_from < time.time() < self._valid_to
 
     @property
     def key(self) -> bytes:
-        return self.extract_key_from_packet(self.data)
+        return self._key
 
     @property
     def body(self) -> bytes:
-        adv = self.advertisement_template()
-        adv[7:29] = self.key[6:28]
-        adv[29] = self.key[0] >> 6
-        return adv
+        return self._body
 
     @property
     def addr(self) -> bytes:
-        addr = bytearray(self.key[:6])
-        addr[0] |= 0b11000000
-        return addr[::-1]
+        return self._addr
 
     def to_dict(self) -> Dict[str, Any]:
         """Returns a dictionary representation of the object
@@ -168,15 +306,64 @@ class AirTag(Base):
             "valid_to": self.valid_to.isoformat(),
             "valid_for": str(self.valid_for),
             "valid": self.is_valid,
+            "valid_until": self._valid_to,
+            "weight": self.weight,
         }
 
-    def to_json(self) -> str:
+    def to_record(self, valid: bool = None) -> bytes:
+        """Returns the binary feed record of the object
+
+        Args:
+            valid: whether to render the tag as valid (default: None, i.e.,
+                whether it's valid now)
+
+        Returns:
+            bytes: the fixed-size record of the tag for the binary feed
+        """
+        if valid is None:
+            valid = self.is_valid
+        return FEED_RECORD.pack(
+            self.id,
+            self.addr[::-1],
+            self.body,
+            self._valid_to if valid else 0,
+            self.weight,
+        )
+
+    def json_fragment(self) -> str:
+        """Returns the members of the JSON representation that only change on updates
+
+        Returns:
+            str: the comma-separated members, without the enclosing braces
+        """
+        # The ID is left out as it's only known after inserting, and the weight
+        # as updates don't necessarily change it
+        fragment = self.to_dict()
+        for member in ["id", "valid", "weight"]:
+            del fragment[member]
+        return json.dumps(fragment, separators=(",", ":"))[1:-1]
+
+    def to_json(self, valid: bool = None) -> str:
         """Returns a JSON representation of the object
 
+        Only adds the members that may change without an update to the cached
+        JSON fragment, so this is much cheaper than serializing to_dict.
+
+        Args:
+            valid: whether to render the tag as valid (default: None, i.e.,
+                whether it's valid now)
+
         Returns:
             str: the JSON representation of the tag
         """
-        return json.dumps(self.to_dict())
+        if valid is None:
+            valid = self.is_valid
+        return '{"id":%d,"weight":%d,"valid":%s,%s}' % (
+            self.id,
+            self.weight,
+            "true" if valid else "false",
+            self._json,
+        )
 
     @classmethod
     def advertisement_template(cls) -> bytes:
@@ -190,7 +377,7 @@ class AirTag(Base):
         adv += "ff"  # manufacturer specific data
         adv += "4c00"  # company ID (Apple)
         adv += "1219"  # offline finding type and length
-        adv += "00"  # state
+        adv += "10"  # state
         for _ in range(22):  # key[6:28]
             adv += "00"
         adv += "00"  # first two bits of key[0]
@@ -217,13 +404,1105 @@ class AirTag(Base):
         return key
 
 
+class Coverage(Base):
+    """Coverage of an AirTag by a relay within a coverage period
+
+    A row exists once the AirTag is assigned to the relay for the period (see
+    assign_tags) or the relay reported advertising it (see add_coverage), so
+    the rows of a period count the relays covering the AirTag.
+
+    Attributes:
+        period (int): the coverage period, i.e., its start in epoch seconds
+            divided by COVERAGE_PERIOD
+        relay (str): identifier of the relay
+        airtag_id (int): ID of the AirTag
+        airtime (int): air time (in ms) the relay reported for the AirTag
+    """
+
+    __tablename__ = "coverage"
+    period = Column(Integer, primary_key=True)
+    relay = Column(String, primary_key=True)
+    airtag_id = Column(Integer, primary_key=True)
+    airtime = Column(Integer, nullable=False, default=0)
+
+    # Covers counting the relays per AirTag
+    __table_args__ = (Index("ix_coverage_airtag", "period", "airtag_id"),)
+
+
+class Meta(Base):
+    """State of the server that outlives its processes
+
+    Attributes:
+        key (str): name of the value
+        value (int): the value
+    """
+
+    __tablename__ = "meta"
+    key = Column(String, primary_key=True)
+    value = Column(Integer, nullable=False)
+
+
+class SnapshotTag(NamedTuple):
+    """An AirTag in a Snapshot, pre-rendered as valid"""
+
+    id: int
+    version: int
+    valid_from: int
+    valid_to: int
+    json: str
+    record: bytes
+
+    @classmethod
+    def of(cls, airtag: AirTag) -> "SnapshotTag":
+        return cls(
+            airtag.id,
+            airtag.version,
+            airtag._valid_from,
+            airtag._valid_to,
+            airtag.to_json(valid=True),
+            airtag.to_record(valid=True),
+        )
+
+
+def ring_hash(value: int) -> int:
+    """Returns the position of a value on the hash ring (see HashRing)
+
+    Args:
+        value: a non-negative integer below 2^64
+
+    Returns:
+        int: the position, a well-mixed 64 bit integer (splitmix64)
+    """
+    value = (value + 0x9E3779B97F4A7C15) & 0xFFFFFFFFFFFFFFFF
+    value = ((value ^ (value >> 30)) * 0xBF58476D1CE4E5B9) & 0xFFFFFFFFFFFFFFFF
+    value = ((value ^ (value >> 27)) * 0x94D049BB133111EB) & 0xFFFFFFFFFFFFFFFF
+    return value ^ (value >> 31)
+
+
+class HashRing:
+    """Consistent hash ring of the active relays
+
+    Every relay takes SHARD_VNODES points on the ring, derived from its
+    identifier only, so it gets the same shard after restarts of the server. A
+    tag belongs to the relays of the first points following its own position,
+    so when a relay joins or leaves, only the tags next to its points move to
+    another relay.
+
+    Attributes:
+        members (FrozenSet[str]): identifiers of the relays on the ring
+    """
+
+    def __init__(self, members: FrozenSet[str]):
+        self.members = members
+        points = sorted(
+            (ring_hash(zlib.crc32(f"{relay}#{vnode}".encode())), relay)
+            for relay in members
+            for vnode in range(SHARD_VNODES)
+        )
+        self.points = [p for p, _ in points]
+        self.relays = [r for _, r in points]
+        self.owners_of: Dict[Tuple[int, int], FrozenSet[str]] = {}
+
+    def owners(self, airtag_id: int, replicas: int) -> FrozenSet[str]:
+        """Returns the relays a tag belongs to
+
+        Args:
+            airtag_id: ID of the tag
+            replicas: number of relays every tag belongs to
+
+        Returns:
+            FrozenSet[str]: identifiers of the relays (fewer than replicas if
+                there are fewer relays)
+        """
+        key = (airtag_id, replicas)
+        if key not in self.owners_of:
+            owners: List[str] = []
+            start = bisect.bisect(self.points, ring_hash(airtag_id))
+            for i in range(len(self.relays)):
+                if len(owners) == min(replicas, len(self.members)):
+                    break
+                relay = self.relays[(start + i) % len(self.relays)]
+                if relay not in owners:
+                    owners.append(relay)
+            self.owners_of[key] = frozenset(owners)
+        return self.owners_of[key]
+
+
+class Snapshot:
+    """Immutable in-memory snapshot of the currently valid AirTags
+
+    Relays only ever fetch the valid tags, so their requests are served from
+    the snapshot without touching the database. Changes create a new snapshot
+    that replaces the current one in a single assignment (see update_snapshot
+    and current_snapshot), so readers don't need any lock. Every rendering of a
+    window of tags is cached, as relays mostly fetch the same windows.
+
+    Attributes:
+        tags (List[SnapshotTag]): the valid tags, ordered by ID
+        pending (List[SnapshotTag]): the tags that become valid later, ordered
+            by valid_from
+        ids (List[int]): the IDs of the valid tags, in the same order
+        expires (float): time (epoch seconds) at which the next tag expires or
+            becomes valid, i.e., until which the snapshot is current (updates
+            may leave it earlier, which only advances the snapshot early)
+        version (int): change version up to which the snapshot has all changes
+            (it may have later ones, too)
+    """
+
+    def __init__(
+        self,
+        tags: List[SnapshotTag],
+        pending: List[SnapshotTag],
+        version: int,
+        ids: List[int] = None,
+        expires: float = None,
+    ):
+        self.tags = tags
+        self.pending = pending
+        self.version = version
+        self.ids = [t.id for t in tags] if ids is None else ids
+        if expires is None:
+            expires = min(
+                [t.valid_to for t in tags] + [t.valid_from for t in pending],
+                default=math.inf,
+            )
+        self.expires = expires
+        self.renderings: Dict[Tuple[str, int, int], Tuple[Any, Optional[int]]] = {}
+        self.shards: Dict[Tuple[FrozenSet[int], int, int], List[SnapshotTag]] = {}
+
+    @classmethod
+    def load(cls, session: Session, now: float, version: int) -> "Snapshot":
+        """Loads the snapshot from the database
+
+        Args:
+            session: DB session to load the tags with
+            now: time (epoch seconds) of the snapshot
+            version: change version up to which all changes are committed
+
+        Returns:
+            Snapshot: the snapshot of the tags valid at the given time
+        """
+        airtags = (
+            session.query(AirTag)
+            .filter(now < AirTag._valid_to)
+            .order_by(AirTag.id)
+            .all()
+        )
+        tags = [SnapshotTag.of(a) for a in airtags if a._valid_from < now]
+        pending = [SnapshotTag.of(a) for a in airtags if now <= a._valid_from]
+        return cls(tags, sorted(pending, key=lambda t: t.valid_from), version)
+
+    def advance(self, now: float) -> "Snapshot":
+        """Returns the snapshot as of a later time
+
+        Args:
+            now: time (epoch seconds) of the new snapshot
+
+        Returns:
+            Snapshot: the snapshot without the tags expired since, and with the
+                tags that became valid since
+        """
+        split = bisect.bisect_left(self.pending, now, key=lambda t: t.valid_from)
+        tags = [t for t in self.tags if now < t.valid_to]
+        tags += [t for t in self.pending[:split] if now < t.valid_to]
+        tags.sort(key=lambda t: t.id)
+        return Snapshot(tags, self.pending[split:], self.version)
+
+    def update(
+        self, changes: List[SnapshotTag], now: float, version: int = None
+    ) -> "Snapshot":
+        """Returns the snapshot with inserted or updated tags
+
+        Only the changed tags are inserted into (or removed from) copies of the
+        sorted lists, the pending tags are only copied if a change affects
+        them.
+
+        Args:
+            changes: the inserted or updated tags
+            now: current time (epoch seconds)
+            version: change version up to which the changes are complete (None
+                if they aren't)
+
+        Returns:
+            Snapshot: the updated snapshot (keeping the tags it has a newer
+                version of already)
+        """
+        tags, ids, pending = self.tags[:], self.ids[:], self.pending
+        waiting = {t.id: t for t in pending}
+        expires = self.expires
+        latest: Dict[int, SnapshotTag] = {}
+        for tag in changes:
+            if tag.id not in latest or latest[tag.id].version <= tag.version:
+                latest[tag.id] = tag
+        for tag in latest.values():
+            index = bisect.bisect_left(ids, tag.id)
+            if index < len(ids) and ids[index] == tag.id:
+                if tag.version < tags[index].version:
+                    continue
+                del tags[index], ids[index]
+            elif tag.id in waiting:
+                if tag.version < waiting[tag.id].version:
+                    continue
+                if pending is self.pending:
+                    pending = pending[:]
+                pending.remove(waiting.pop(tag.id))
+            if tag.valid_from < now < tag.valid_to:
+                tags.insert(index, tag)
+                ids.insert(index, tag.id)
+                expires = min(expires, tag.valid_to)
+            elif now <= tag.valid_from:
+                if pending is self.pending:
+                    pending = pending[:]
+                bisect.insort(pending, tag, key=lambda t: t.valid_from)
+                waiting[tag.id] = tag
+                expires = min(expires, tag.valid_from)
+        return Snapshot(tags, pending, max(self.version, version or 0), ids, expires)
+
+    def render(
+        self, feed_format: str, start: int, num: int
+    ) -> Tuple[Any, Optional[int]]:
+        """Renders a window of the tags
+
+        Args:
+            feed_format: "json" or "bin" (see get_tags)
+            start: index of the first tag of the window
+            num: number of tags in the window, wrapping around to the first tags
+                at the end (0 for all tags)
+
+        Returns:
+            Tuple[Any, Optional[int]]: the rendered window and the ID of its
+                last tag (None if it's empty)
+        """
+        window = (feed_format, start, num)
+        if window not in self.renderings:
+            if num > 0:
+                tags = self.tags[start : start + num]
+                tags += self.tags[: min(start, num - len(tags))]
+            else:
+                tags = self.tags[start:] + self.tags[:start]
+            rendering = self.pack(feed_format, tags)
+            self.renderings[window] = (rendering, tags[-1].id if tags else None)
+        return self.renderings[window]
+
+    @staticmethod
+    def pack(feed_format: str, tags: List[SnapshotTag]) -> Any:
+        """Renders a list of tags
+
+        Args:
+            feed_format: "json" or "bin" (see get_tags)
+            tags: the tags to render
+
+        Returns:
+            Any: the JSON list or the binary tag feed
+        """
+        if feed_format == "bin":
+            return feed_header(len(tags)) + b"".join(t.record for t in tags)
+        return "[" + ",".join(t.json for t in tags) + "]"
+
+    def shard(self, ring: HashRing, relay: str, replicas: int) -> List[SnapshotTag]:
+        """Returns the tags that belong to a relay
+
+        Args:
+            ring: hash ring of the active relays
+            relay: identifier of the relay
+            replicas: number of relays every tag belongs to
+
+        Returns:
+            List[SnapshotTag]: the relay's tags, ordered by ID
+        """
+        key = (ring.members, relay, replicas)
+        if key not in self.shards:
+            self.shards[key] = [
+                t for t in self.tags if relay in ring.owners(t.id, replicas)
+            ]
+        return self.shards[key]
+
+    def find(self, airtag_id: int) -> Optional[SnapshotTag]:
+        """Returns the valid tag with the given ID
+
+        Args:
+            airtag_id: ID of the tag
+
+        Returns:
+            Optional[SnapshotTag]: the tag, or None if it isn't valid
+        """
+        index = bisect.bisect_left(self.ids, airtag_id)
+        if index < len(self.ids) and self.ids[index] == airtag_id:
+            return self.tags[index]
+        return None
+
+    def after(self, cursor: int) -> int:
+        """Returns the index of the first tag after the given ID
+
+        Args:
+            cursor: ID of a tag (which doesn't need to be in the snapshot)
+
+        Returns:
+            int: the index of the first tag with a higher ID (0 if there's none)
+        """
+        index = bisect.bisect_right(self.ids, cursor)
+        return index if index < len(self.ids) else 0
+
+
+def connect(sqlitedb: str, pool_size: int, immediate: bool = False) -> Engine:
+    """Creates a database engine for concurrent use
+
+    The connections use SQLite's write-ahead log, so readers and the writer
+    don't block each other, and wait for locks instead of failing right away.
+
+    Args:
+        sqlitedb: SQLite database file
+        pool_size: number of connections to keep open
+        immediate: whether transactions take the write lock when they begin,
+            instead of failing when they try to upgrade a read to a write lock
+            after another write
+
+    Returns:
+        Engine: the database engine
+    """
+    engine = create_engine(
+        "sqlite:///" + sqlitedb, pool_size=pool_size, max_overflow=pool_size
+    )
+
+    @event.listens_for(engine, "connect")
+    def on_connect(dbapi_connection, connection_record):
+        # Let SQLAlchemy begin the transactions instead of the driver
+        dbapi_connection.isolation_level = None
+        # Only takes effect on new databases, before anything else is written
+        dbapi_connection.execute("PRAGMA auto_vacuum=INCREMENTAL")
+        dbapi_connection.execute("PRAGMA journal_mode=WAL")
+        dbapi_connection.execute(f"PRAGMA busy_timeout={BUSY_TIMEOUT}")
+        # Only syncs on checkpoints, which is safe with the write-ahead log
+        dbapi_connection.execute("PRAGMA synchronous=NORMAL")
+
+    @event.listens_for(engine, "begin")
+    def on_begin(conn):
+        conn.exec_driver_sql("BEGIN IMMEDIATE" if immediate else "BEGIN")
+
+    return engine
+
+
+def migrate(engine: Engine):
+    """Migrates an existing database to the current schema
+
+    Only adds what's missing, so this is a no-op on databases created by
+    Base.metadata.create_all.
+
+    Args:
+        engine: database engine to migrate
+    """
+    columns = {c["name"]: c for c in inspect(engine).get_columns(AirTag.__tablename__)}
+    indexes = [i["name"] for i in inspect(engine).get_indexes(AirTag.__tablename__)]
+    with engine.begin() as conn:
+        if "_version" not in columns:
+            log.info("Adding change version column to database")
+            conn.execute(
+                text("ALTER TABLE airtags ADD COLUMN _version INTEGER NOT NULL DEFAULT 0")
+            )
+            conn.execute(
+                text("CREATE INDEX IF NOT EXISTS ix_airtags__version ON airtags (_version)")
+            )
+        if "_weight" not in columns:
+            log.info("Adding weight column to database")
+            conn.execute(
+                text("ALTER TABLE airtags ADD COLUMN _weight INTEGER NOT NULL DEFAULT 1")
+            )
+        if "ix_airtags__data" not in indexes:
+            log.info("Adding unique advertisement data index to database")
+            # Concurrent uploads of the same tag could insert it twice before,
+            # keep only the most recently changed copy
+            conn.execute(
+                text(
+                    "DELETE FROM airtags WHERE id IN ("
+                    "SELECT id FROM (SELECT id, ROW_NUMBER() OVER ("
+                    "PARTITION BY _data ORDER BY _version DESC, id DESC) AS n "
+                    "FROM airtags) WHERE n > 1)"
+                )
+            )
+            conn.execute(
+                text("CREATE UNIQUE INDEX ix_airtags__data ON airtags (_data)")
+            )
+        if isinstance(columns["_valid_from"]["type"], DateTime):
+            log.info("Converting validity columns to epoch seconds")
+            # SQLite can't change the type of a column, so replace the columns.
+            # The datetimes are stored in local time, like datetime.now().
+            for column in ["_valid_from", "_valid_to"]:
+                conn.execute(
+                    text(f"ALTER TABLE airtags RENAME COLUMN {column} TO {column}_old")
+                )
+                conn.execute(text(f"ALTER TABLE airtags ADD COLUMN {column} INTEGER"))
+                conn.execute(
+                    text(
+                        f"UPDATE airtags SET {column} = "
+                        f"CAST(strftime('%s', {column}_old, 'utc') AS INTEGER)"
+                    )
+                )
+                conn.execute(text(f"ALTER TABLE airtags DROP COLUMN {column}_old"))
+        conn.execute(
+            text(
+                "CREATE INDEX IF NOT EXISTS ix_airtags__valid "
+                "ON airtags (_valid_to, _valid_from, id)"
+            )
+        )
+        if "_json" not in columns:
+            log.info("Adding extracted advertisement columns to database")
+            for column, column_type in [
+                ("_key", "BLOB"),
+                ("_addr", "BLOB"),
+                ("_body", "BLOB"),
+                ("_json", "VARCHAR"),
+            ]:
+                conn.execute(
+                    text(f"ALTER TABLE airtags ADD COLUMN {column} {column_type}")
+                )
+            rows = conn.execute(
+                text("SELECT id, _data, _valid_from, _valid_to FROM airtags")
+            ).all()
+            updates = []
+            for airtag_id, data, valid_from, valid_to in rows:
+                try:
+                    airtag = AirTag(
+                        data,
+                        datetime.datetime.fromtimestamp(valid_from),
+                        datetime.datetime.fromtimestamp(valid_to),
+                    )
+                except ValueError:
+                    # Such tags could never be relayed
+                    log.warning(f"Removing AirTag {airtag_id} with invalid data")
+                    conn.execute(
+                        text("DELETE FROM airtags WHERE id = :id"), {"id": airtag_id}
+                    )
+                    continue
+                updates.append(
+                    {
+                        "id": airtag_id,
+                        "key": airtag.key,
+                        "addr": airtag.addr,
+                        "body": airtag.body,
+                        "json": airtag._json,
+                    }
+                )
+            if updates:
+                conn.execute(
+                    text(
+                        "UPDATE airtags SET _key = :key, _addr = :addr, "
+                        "_body = :body, _json = :json WHERE id = :id"
+                    ),
+                    updates,
+                )
+
+
+def reserve_version() -> int:
+    """Reserves a new change version for an insert/update of an AirTag
+
+    Versions are microsecond timestamps, made strictly monotonic across all
+    worker processes. The version stays pending until it's released via
+    release_version after the change is committed (or rolled back). Must be
+    called in a write transaction, which holds SQLite's write lock (see
+    connect), so at most one version is pending at a time.
+
+    Returns:
+        int: the reserved version
+    """
+    with current_app.version.get_lock():
+        now = time.time_ns() // 1000
+        current_app.version.value = max(current_app.version.value + 1, now)
+        current_app.pending_version.value = current_app.version.value
+        return current_app.version.value
+
+
+def release_version(version: int):
+    """Releases a version reserved via reserve_version
+
+    Args:
+        version: the version to release
+    """
+    with current_app.version.get_lock():
+        # A later write may have reserved its version already
+        if current_app.pending_version.value == version:
+            current_app.pending_version.value = 0
+
+
+def current_version(now: datetime.datetime) -> int:
+    """Returns the change version as of the given time
+
+    All changes with a higher version are guaranteed to be visible to later
+    queries. Changes that are still pending hold the version back, so a relay
+    never skips over a change that isn't committed yet.
+
+    Args:
+        now: the time of the query the version is returned for
+
+    Returns:
+        int: the change version
+    """
+    with current_app.version.get_lock():
+        current_app.version.value = max(
+            current_app.version.value, int(now.timestamp() * 1e6)
+        )
+        if current_app.pending_version.value:
+            return current_app.pending_version.value - 1
+        return current_app.version.value
+
+
+def relay_slot(relay: str) -> int:
+    """Returns the slot of a relay in the state shared by the workers and marks
+    it as seen
+
+    The slots form a hash table with open addressing that stores the relays'
+    identifiers, so every relay gets a slot of its own. Once all slots are
+    taken, a new relay takes over the slot of the relay seen least recently,
+    starting over with its cursor.
+
+    Args:
+        relay: identifier of the relay
+
+    Returns:
+        int: the slot
+    """
+    # Prefixed with the length, so no key is all zeros like a free slot
+    key = relay.encode()
+    key = bytes([len(key) + 1]) + key
+    start = zlib.crc32(key) % CURSOR_SLOTS
+    with current_app.relay_ids.get_lock():
+        keys = current_app.relay_ids.get_obj()
+        seen = current_app.relays_seen.get_obj()
+        oldest = start
+        for i in range(CURSOR_SLOTS):
+            slot = (start + i) % CURSOR_SLOTS
+            offset = slot * RELAY_KEY_LEN
+            if keys[offset : offset + len(key)] == key or keys[offset] == b"\0":
+                break
+            if seen[slot] < seen[oldest]:
+                oldest = slot
+        else:
+            slot = oldest
+        offset = slot * RELAY_KEY_LEN
+        if keys[offset : offset + len(key)] != key:
+            keys[offset : offset + RELAY_KEY_LEN] = key.ljust(RELAY_KEY_LEN, b"\0")
+            current_app.cursors[slot] = 0
+        seen[slot] = time.time()
+    return slot
+
+
+def next_cursor(relay: str, cursor: int = None) -> int:
+    """Returns the rotation cursor of a relay and optionally advances it
+
+    Args:
+        relay: identifier of the relay
+        cursor: ID of the last tag sent to the relay, or None to leave the
+            cursor as is
+
+    Returns:
+        int: the ID of the last tag sent to the relay before (0 for none)
+    """
+    slot = relay_slot(relay)
+    with current_app.cursors.get_lock():
+        previous = current_app.cursors[slot]
+        if cursor is not None:
+            current_app.cursors[slot] = cursor
+        return previous
+
+
+def current_ring(relay: str) -> HashRing:
+    """Returns the hash ring of the active relays
+
+    Relays are active until RELAY_TIMEOUT after their last poll, as marked in
+    their slots (see relay_slot). Every worker keeps its own ring, picking up
+    relays that joined or left via other workers every SNAPSHOT_REFRESH, and
+    relays that poll it right away.
+
+    Args:
+        relay: identifier of the polling relay, which must be marked as seen
+
+    Returns:
+        HashRing: the ring, including the polling relay
+    """
+    now = time.time()
+    ring = current_app.ring
+    if relay in ring.members and time.monotonic() < current_app.ring_refresh_at:
+        return ring
+    with current_app.ring_lock:
+        ring = current_app.ring
+        if relay not in ring.members or current_app.ring_refresh_at <= time.monotonic():
+            with current_app.relay_ids.get_lock():
+                keys = current_app.relay_ids.get_obj().raw
+                seen = current_app.relays_seen[:]
+            # The keys are the identifiers prefixed with their length plus one
+            members = frozenset(
+                keys[offset + 1 : offset + keys[offset]].decode()
+                for offset, t in zip(range(0, len(keys), RELAY_KEY_LEN), seen)
+                if now - RELAY_TIMEOUT < t
+            )
+            if members != ring.members:
+                ring = current_app.ring = HashRing(members)
+            current_app.ring_refresh_at = time.monotonic() + SNAPSHOT_REFRESH
+        return ring
+
+
+def current_snapshot() -> Snapshot:
+    """Returns the current snapshot of the valid tags
+
+    Refreshes only replace the snapshot if other worker processes changed tags,
+    otherwise they just advance the worker's snapshot_version, the version up to
+    which the snapshot has all changes.
+
+    Returns:
+        Snapshot: the snapshot, first updated with the changes of other worker
+            processes or advanced if tags expired or became valid
+    """
+    snapshot = current_app.snapshot
+    now = time.time()
+    expired = snapshot.expires <= now
+    if not expired and time.monotonic() < current_app.refresh_at:
+        return snapshot
+    # Only wait for another thread updating the snapshot if it expired
+    if not current_app.snapshot_lock.acquire(blocking=expired):
+        return snapshot
+    try:
+        snapshot = current_app.snapshot
+        version = None
+        if current_app.refresh_at <= time.monotonic():
+            # Get the version first, as later changes may not be committed yet
+            version = current_version(datetime.datetime.now())
+            with current_app.session() as session, session.begin():
+                changes = (
+                    session.query(AirTag)
+                    .filter(AirTag._version > current_app.snapshot_version)
+                    .all()
+                )
+                changes = [SnapshotTag.of(a) for a in changes]
+            # Keep the snapshot, and the renderings it cached, if nothing changed
+            if changes:
+                snapshot = snapshot.update(changes, now, version)
+            current_app.refresh_at = time.monotonic() + SNAPSHOT_REFRESH
+        if snapshot.expires <= now:
+            snapshot = snapshot.advance(now)
+        current_app.snapshot = snapshot
+        # Only after the snapshot, as readers take the version before it
+        if version is not None:
+            current_app.snapshot_version = version
+        return snapshot
+    finally:
+        current_app.snapshot_lock.release()
+
+
+def update_snapshot(airtags: List[AirTag]):
+    """Replaces the snapshot of the valid tags with one including changes
+
+    Args:
+        airtags: the inserted or updated AirTags
+    """
+    tags = [SnapshotTag.of(a) for a in airtags]
+    with current_app.snapshot_lock:
+        current_app.snapshot = current_app.snapshot.update(tags, time.time())
+
+
+def assign_tags(snapshot: Snapshot, relay: str, num: int) -> List[SnapshotTag]:
+    """Returns the tags assigned to a relay for the current coverage period
+
+    A relay keeps the tags assigned to it for the whole period, so each of them
+    gets a relay's worth of air time. Its assignment is only topped up with
+    further tags if some of them expired (or more tags became valid). Those go
+    to the tags covered by the fewest relays in the period, up to the coverage
+    target, and otherwise to the tags that got the least air time reported in
+    the previous period. Remaining ties rotate from the relay's cursor, so
+    relays polling at the same time spread out over the tags.
+
+    Args:
+        snapshot: the snapshot of the valid tags
+        relay: identifier of the relay
+        num: number of tags to assign to the relay
+
+    Returns:
+        List[SnapshotTag]: the tags assigned to the relay
+    """
+    period = int(time.time() // COVERAGE_PERIOD)
+    num = min(num, len(snapshot.tags))
+
+    def assigned(session: Session) -> List[SnapshotTag]:
+        airtag_ids = session.query(Coverage.airtag_id).filter(
+            Coverage.period == period, Coverage.relay == relay
+        )
+        tags = [snapshot.find(airtag_id) for (airtag_id,) in airtag_ids]
+        return sorted([t for t in tags if t is not None], key=lambda t: t.id)
+
+    with current_app.session() as session, session.begin():
+        tags = assigned(session)
+    if len(tags) >= num:
+        return tags[:num]
+
+    with current_app.write_session() as session, session.begin():
+        # Other workers may have assigned tags to the relay in the meantime
+        tags = assigned(session)
+        if len(tags) >= num:
+            return tags[:num]
+        relays = dict(
+            session.query(Coverage.airtag_id, func.count())
+            .filter(Coverage.period == period)
+            .group_by(Coverage.airtag_id)
+        )
+        airtime = dict(
+            session.query(Coverage.airtag_id, func.sum(Coverage.airtime))
+            .filter(Coverage.period == period - 1)
+            .group_by(Coverage.airtag_id)
+        )
+        start = snapshot.after(next_cursor(relay))
+        taken = {t.id for t in tags}
+        rotation = snapshot.tags[start:] + snapshot.tags[:start]
+        candidates = [t for t in rotation if t.id not in taken]
+        # Stable, so ties keep their order of rotation
+        candidates.sort(
+            key=lambda t: (
+                min(relays.get(t.id, 0), current_app.coverage),
+                airtime.get(t.id, 0),
+            )
+        )
+        added = candidates[: num - len(tags)]
+        for i in range(0, len(added), UPSERT_CHUNK):
+            session.execute(
+                insert(Coverage)
+                .values(
+                    [
+                        {"period": period, "relay": relay, "airtag_id": t.id}
+                        for t in added[i : i + UPSERT_CHUNK]
+                    ]
+                )
+                .on_conflict_do_nothing()
+            )
+    if added:
+        next_cursor(relay, added[-1].id)
+    return sorted(tags + added, key=lambda t: t.id)
+
+
+def upsert_tags(
+    session: Session, airtags: List[AirTag], weighted: List[bool], version: int
+):
+    """Inserts AirTags or updates the existing ones, in as few statements as possible
+
+    Sets the ID, weight, and version of the given objects to the ones stored.
+    Of multiple AirTags with the same data, the last one wins.
+
+    Args:
+        session: DB session to upsert the tags in
+        airtags: the AirTags to upsert
+        weighted: whether the weight of the corresponding AirTag was given,
+            otherwise updates keep the weight stored
+        version: change version of the upsert
+    """
+    # Only upsert the last of duplicate tags, with the last weight given
+    latest: Dict[str, Tuple[AirTag, bool]] = {}
+    for airtag, has_weight in zip(airtags, weighted):
+        if not has_weight and latest.get(airtag.data, (None, False))[1]:
+            airtag.weight, has_weight = latest[airtag.data][0].weight, True
+        latest[airtag.data] = (airtag, has_weight)
+
+    stored: Dict[str, Tuple[int, int]] = {}
+    for keep_weight in [False, True]:
+        batch = [a for a, w in latest.values() if w != keep_weight]
+        for i in range(0, len(batch), UPSERT_CHUNK):
+            chunk = batch[i : i + UPSERT_CHUNK]
+            # Insert, or update the tags that exist already, on the unique index
+            stmt = insert(AirTag).values(
+                [
+                    {
+                        "_data": a.data,
+                        "_valid_from": a._valid_from,
+                        "_valid_to": a._valid_to,
+                        "_version": version,
+                        "_weight": a.weight,
+                        "_key": a.key,
+                        "_addr": a.addr,
+                        "_body": a.body,
+                        "_json": a._json,
+                    }
+                    for a in chunk
+                ]
+            )
+            update = {
+                "_valid_from": stmt.excluded._valid_from,
+                "_valid_to": stmt.excluded._valid_to,
+                "_version": stmt.excluded._version,
+                "_json": stmt.excluded._json,
+            }
+            if not keep_weight:
+                update["_weight"] = stmt.excluded._weight
+            stmt = stmt.on_conflict_do_update(index_elements=["_data"], set_=update)
+            # SQLite returns the rows in arbitrary order
+            stored.update(
+                (data, (airtag_id, weight))
+                for data, airtag_id, weight in session.execute(
+                    stmt.returning(AirTag._data, AirTag.id, AirTag._weight)
+                )
+            )
+    for airtag in airtags:
+        airtag.id, airtag.weight = stored[airtag.data]
+        airtag.version = version
+
+
+def prune(statement: str, **params) -> int:
+    """Runs a statement deleting at most COMPACT_BATCH rows until it deletes fewer
+
+    Args:
+        statement: the DELETE statement, limited to :batch rows
+        params: further parameters of the statement
+
+    Returns:
+        int: the number of deleted rows
+    """
+    pruned = 0
+    while True:
+        with current_app.write_session() as session, session.begin():
+            deleted = session.execute(
+                text(statement), {**params, "batch": COMPACT_BATCH}
+            ).rowcount
+        pruned += deleted
+        if deleted < COMPACT_BATCH:
+            return pruned
+        time.sleep(COMPACT_PAUSE)
+
+
+def compact(retention: float):
+    """Deletes the AirTags that expired more than the retention period ago
+
+    Also deletes the coverage of the periods before the retention period.
+    Relays syncing changes since a version before the cutoff would miss that
+    the deleted AirTags expired, so the cutoff is recorded as the compaction
+    horizon first (see get_tags). Deletes in small batches with a transaction
+    each, so uploads never wait for more than one batch. Then returns the free
+    pages to the file system (if the database was created with incremental
+    auto-vacuum) and checkpoints the write-ahead log, as far as that's possible
+    without waiting for readers.
+
+    Args:
+        retention: time (in s) to keep expired AirTags for
+    """
+    cutoff = int(time.time() - retention)
+    with current_app.compacted_before.get_lock():
+        # The cutoff as a change version, which only ever moves forward
+        horizon = max(current_app.compacted_before.value, cutoff * 1_000_000)
+        current_app.compacted_before.value = horizon
+    with current_app.write_session() as session, session.begin():
+        session.merge(Meta(key="compacted_before", value=horizon))
+    pruned = prune(
+        "DELETE FROM airtags WHERE id IN (SELECT id FROM airtags "
+        "WHERE _valid_to < :cutoff LIMIT :batch)",
+        cutoff=cutoff,
+    )
+    # Always keeps the previous period, which assign_tags looks at
+    prune(
+        "DELETE FROM coverage WHERE rowid IN (SELECT rowid FROM coverage "
+        "WHERE period < :period LIMIT :batch)",
+        period=cutoff // COVERAGE_PERIOD - 1,
+    )
+
+    # Both pragmas must run outside of transactions
+    conn = current_app.write_engine.raw_connection()
+    try:
+        cursor = conn.cursor()
+        # Frees only a single page per step, so run it as a script
+        cursor.executescript("PRAGMA incremental_vacuum")
+        cursor.execute("PRAGMA wal_checkpoint(PASSIVE)").fetchall()
+        page_size = cursor.execute("PRAGMA page_size").fetchone()[0]
+        pages = cursor.execute("PRAGMA page_count").fetchone()[0]
+        free_pages = cursor.execute("PRAGMA freelist_count").fetchone()[0]
+    finally:
+        conn.close()
+    log.info(
+        f"Pruned {pruned} expired AirTags, database size is "
+        f"{pages * page_size} bytes ({free_pages * page_size} bytes free)"
+    )
+
+
+def compactor(retention: float):
+    """Compacts the database every COMPACT_INTERVAL
+
+    Every worker process runs a compactor, but they only compact once per
+    interval between all of them.
+
+    Args:
+        retention: time (in s) to keep expired AirTags for
+    """
+    with app.app_context():
+        while True:
+            with current_app.next_compaction.get_lock():
+                now = time.time()
+                due = current_app.next_compaction.value <= now
+                if due:
+                    current_app.next_compaction.value = now + COMPACT_INTERVAL
+            if due:
+                try:
+                    compact(retention)
+                except Exception:
+                    log.exception("Compacting the database failed")
+            time.sleep(min(COMPACT_INTERVAL, 60.0))
+
+
+def store_tags(airtags: List[AirTag], weighted: List[bool]) -> bool:
+    """Stores AirTags, or queues them for the writer thread in write-behind mode
+
+    Args:
+        airtags: the AirTags to store
+        weighted: whether the weight of the corresponding AirTag was given
+
+    Raises:
+        queue.Full: if too many requests are queued already
+
+    Returns:
+        bool: whether the AirTags were stored (False if they were queued)
+    """
+    if current_app.ingest_queue is not None:
+        current_app.ingest_queue.put_nowait((airtags, weighted))
+        return False
+    commit_tags(airtags, weighted)
+    return True
+
+
+def commit_tags(airtags: List[AirTag], weighted: List[bool]):
+    """Upserts AirTags in a single transaction
+
+    Args:
+        airtags: the AirTags to upsert
+        weighted: whether the weight of the corresponding AirTag was given
+    """
+    version = None
+    try:
+        with current_app.write_session() as session, session.begin():
+            # Take the write lock first, so versions are reserved in commit order
+            session.connection()
+            version = reserve_version()
+            upsert_tags(session, airtags, weighted, version)
+        update_snapshot(airtags)
+    finally:
+        if version is not None:
+            release_version(version)
+    notify_changes()
+
+
+def ingest_writer(ingest_queue: mp.Queue, interval: float, max_tags: int):
+    """Group-commits the AirTags queued in write-behind mode
+
+    Commits whenever max_tags are queued or interval passed since the first
+    queued AirTag, whichever comes first. Returns after committing everything
+    queued before None. The queue is shared by all worker processes, but only
+    one of them runs the writer (see api_receiver), so there's a single writer
+    grouping all uploads.
+
+    Args:
+        ingest_queue: queue of the AirTags and whether their weight was given
+        interval: maximum time (in s) AirTags stay queued
+        max_tags: maximum number of AirTags per commit
+    """
+    with app.app_context():
+        done = False
+        while not done:
+            queued = [ingest_queue.get()]
+            deadline = time.monotonic() + interval
+            num_tags = len(queued[0][0]) if queued[0] else 0
+            while queued[-1] is not None and num_tags < max_tags:
+                try:
+                    queued.append(
+                        ingest_queue.get(timeout=max(0, deadline - time.monotonic()))
+                    )
+                except queue.Empty:
+                    break
+                num_tags += len(queued[-1][0]) if queued[-1] else 0
+            done = queued[-1] is None
+            airtags = [a for q in queued if q for a in q[0]]
+            weighted = [w for q in queued if q for w in q[1]]
+            if not airtags:
+                continue
+            try:
+                commit_tags(airtags, weighted)
+            except Exception:
+                log.exception(f"Dropping {len(airtags)} queued AirTags")
+
+
+def process_alive(pid: int) -> bool:
+    """Returns whether a process is still running
+
+    Args:
+        pid: ID of the process (0 for none)
+
+    Returns:
+        bool: whether the process exists and belongs to the same user
+    """
+    if pid == 0:
+        return False
+    try:
+        os.kill(pid, 0)
+    except OSError:
+        return False
+    return True
+
+
+def notify_changes():
+    """Wakes up all requests long-polling for changes to the tag set"""
+    with current_app.changes_cond:
+        current_app.changes.value += 1
+        current_app.last_change.value = time.time()
+        current_app.changes_cond.notify_all()
+
+
+def poll_after() -> int:
+    """Returns the time a relay should wait before polling again
+
+    Relays poll quickly while the tag set churns and back off while it's idle.
+    The more of the worker's threads are busy (not counting long-polling
+    requests waiting for changes), the longer they wait. The time is jittered,
+    so relays that polled at the same time spread out.
+
+    Returns:
+        int: the time (in ms)
+    """
+    idle = time.time() - current_app.last_change.value
+    interval = min(max(idle * POLL_BACKOFF, POLL_MIN), POLL_MAX)
+    interval *= 1 + min(current_app.busy / current_app.threads, 1)
+    interval *= 1 + POLL_JITTER * random.uniform(-1, 1)
+    return int(interval * 1000)
+
+
+@app.before_request
+def start_request():
+    with current_app.busy_lock:
+        current_app.busy += 1
+
+
+@app.teardown_request
+def finish_request(exception: Optional[BaseException]):
+    with current_app.busy_lock:
+        current_app.busy -= 1
+
+
+def wait_for_changes(seen: int, timeout: float):
+    """Blocks until the tag set changed or the timeout expired
+
+    The waiting request doesn't count as busy meanwhile (see poll_after).
+
+    Args:
+        seen: the value of the change counter the caller last saw
+        timeout: maximum time (in s) to wait
+    """
+    with current_app.busy_lock:
+        current_app.busy -= 1
+    try:
+        with current_app.changes_cond:
+            current_app.changes_cond.wait_for(
+                lambda: current_app.changes.value != seen, timeout=timeout
+            )
+    finally:
+        with current_app.busy_lock:
+            current_app.busy += 1
+
+
 @app.route("/api/v1/airtag", methods=["POST", "PUT"])
 def add_tag() -> Tuple[str, int]:
     """REST API function that upserts an AirTag
 
     API accepts either binary data (only AirTag payload) or a JSON object of
     containing the mandatory field "data" (base64-encoded payload) and optional
-    "valid_from" and "valid_to" (ISO date string) fields.
+    "valid_from" and "valid_to" (ISO date string) and "weight" (share of the air
+    time relative to other tags, 1 to 65535) fields.
 
     Returns:
         Tuple[str, int]: HTML error/success message and corresponding status code
@@ -234,39 +1513,153 @@ def add_tag() -> Tuple[str, int]:
             data: bytes = request.get_data()
             valid_from = None
             valid_to = None
+            weight = None
         case "application/json":
             data: str = request.json["data"]
             valid_from: str = request.json.get("valid_from", None)
             valid_to: str = request.json.get("valid_to", None)
+            weight: int = request.json.get("weight", None)
         case _:
             return "Not supported", 400
 
-    airtag = AirTag(data=data, valid_from=valid_from, valid_to=valid_to)
-    with current_app.session() as session, session.begin():
-        existing_airtag = session.query(AirTag).filter_by(_data=airtag.data).first()
-        if existing_airtag is not None:
-            # Update
-            existing_airtag.valid_from = valid_from
-            existing_airtag.valid_to = valid_to
-        else:
-            # Insert
-            session.add(airtag)
+    try:
+        airtag = AirTag(
+            data=data, valid_from=valid_from, valid_to=valid_to, weight=weight
+        )
+    except ValueError as e:
+        return str(e), 400
+    try:
+        if not store_tags([airtag], [weight is not None]):
+            return "Accepted AirTag", 202
+    except queue.Full:
+        return "Too many queued AirTags", 503
 
     return "Successfully added AirTag", 200
 
 
+@app.route("/api/v1/airtags:batch", methods=["POST"])
+def add_tags() -> Tuple[Response, int]:
+    """REST API function that upserts multiple AirTags at once
+
+    API accepts either a concatenation of binary AirTag payloads (37 or 39 bytes
+    each, see AirTag.extract_key_from_packet) or a JSON array of objects like
+    the ones add_tag accepts. All tags are upserted in a single transaction.
+
+    Returns:
+        Tuple[Response, int]: JSON array with the status of every tag, in order,
+            and the corresponding status code. A tag's status is an object with
+            the "status" code and either the "id" of the stored tag or an
+            "error" message. Tags queued in write-behind mode have status 202
+            and no ID yet.
+    """
+    items: List[Tuple[Any, Any, Any, Any]] = []
+    match request.content_type.split(";")[0]:
+        case "application/octet-stream":
+            stream: bytes = request.get_data()
+            i = 0
+            while i < len(stream):
+                # The advertisements may or may not start with the two byte PDU
+                # header, but they always have the same body
+                if stream[i + 6 : i + 10] == ADV_PREFIX:
+                    size = 37
+                elif stream[i + 8 : i + 12] == ADV_PREFIX:
+                    size = 39
+                else:
+                    return "Invalid data at offset %d" % i, 400
+                items.append((stream[i : i + size], None, None, None))
+                i += size
+        case "application/json":
+            if not isinstance(request.json, list):
+                return "Not a list", 400
+            for item in request.json:
+                if not isinstance(item, dict):
+                    item = {}
+                items.append(
+                    (
+                        item.get("data", None),
+                        item.get("valid_from", None),
+                        item.get("valid_to", None),
+                        item.get("weight", None),
+                    )
+                )
+        case _:
+            return "Not supported", 400
+    if len(items) > MAX_BATCH:
+        return "Too many tags", 413
+
+    statuses: List[Dict[str, Any]] = []
+    airtags: List[AirTag] = []
+    weighted: List[bool] = []
+    for data, valid_from, valid_to, weight in items:
+        try:
+            airtag = AirTag(
+                data=data, valid_from=valid_from, valid_to=valid_to, weight=weight
+            )
+        except (TypeError, ValueError) as e:
+            statuses.append({"status": 400, "error": str(e) or "Invalid data"})
+            continue
+        statuses.append({"status": 200, "airtag": airtag})
+        airtags.append(airtag)
+        weighted.append(weight is not None)
+
+    stored = True
+    if airtags:
+        try:
+            stored = store_tags(airtags, weighted)
+        except queue.Full:
+            return "Too many queued AirTags", 503
+
+    for status in statuses:
+        if "airtag" not in status:
+            continue
+        airtag = status.pop("airtag")
+        if stored:
+            status["id"] = airtag.id
+        else:
+            status["status"] = 202
+    return jsonify(statuses), 200
+
+
 @app.route("/api/v1/airtag/", methods=["GET"])
 def get_tags() -> Response:
     """REST API function that returns a list of tags.
     The function has the following parameters:
     - valid: truthy value on whether to return only currently valid tags (default: False)
     - num: number of tags to return (default: 0 which indicates to return all tags)
-    - use_offset: truthy value on whether to round-robin iterate through the tags to return
+    - offset: truthy value on whether to round-robin iterate through the tags to return
       (default: False, only effective when valid == True and num > 0)
+    - relay: identifier of the requesting relay (e.g., its MAC address). The
+      round-robin iteration continues after the last tag returned to the same
+      relay (default: "", shared by all relays that don't identify themselves).
+      With a coverage target configured, the relay gets the tags assigned to it
+      for the current coverage period instead (see assign_tags). With
+      replication configured, it gets its shard of the tags (see HashRing),
+      rotating through it only if it can't hold all of it.
+    - format: "json" for a JSON list of tags or "bin" for the binary tag feed
+      (default: "json")
+    - since: change version (from the X-Tag-Version header of a previous
+      response) to only return the tags that were added, renewed, or expired
+      since then (default: None, only effective when valid == True and
+      use_offset == False). Expired tags are returned as invalid, and num is
+      not applied to such delta responses. Versions from before the last
+      compaction get the full set of valid tags instead, as the expired tags
+      deleted since can't be reported anymore.
+    - wait: time (in s) to hold the request open until there are changes since
+      the given version (default: 0, only effective with since, capped at
+      MAX_WAIT). This lets relays long-poll for new tags.
+
+    Every response carries the current change version in the X-Tag-Version
+    header, delta responses are additionally marked by the X-Tag-Delta header.
+    The X-Poll-After header tells the relay how long (in ms) to wait before
+    polling again (see poll_after), except for rotating relays, which keep
+    moving on through the tags at their own pace.
+    If a scheduling policy is configured, it is sent to the relays in the
+    X-Tag-Policy header.
 
     Returns:
         Response: Flask Response object with status code 200 and JSON encoded
-                  list of tags
+                  list of tags or the binary tag feed, or status code 304 if
+                  nothing changed since the given version
     """
     only_valid: bool = request.args.get(
         "valid",
@@ -280,32 +1673,125 @@ def get_tags() -> Response:
         type=lambda x: x.lower() in ["yes", "y", "true", "t", "1"],
     )
     use_offset: bool = only_valid and num_tags > 0 and offset
+    relay: str = request.args.get("relay", default="")
+    if len(relay.encode()) > MAX_RELAY_LEN:
+        return "Invalid relay", 400
+    feed_format: str = request.args.get("format", default="json")
+    if feed_format not in ["json", "bin"]:
+        return "Unsupported format", 400
+    since: int = request.args.get("since", default=None, type=int)
+    use_since: bool = (
+        only_valid
+        and not use_offset
+        and since is not None
+        and since >= current_app.compacted_before.value
+    )
 
-    with current_app.session() as session, session.begin():
-        query = session.query(AirTag)
-        valid_count: int = 0
-
-        if only_valid:
-            # Filter AirTags by currently valid AirTags only
+    wait: float = request.args.get("wait", default=0.0, type=float)
+    deadline: float = time.monotonic() + (min(wait, MAX_WAIT) if use_since else 0)
+
+    ret_val = None
+    if only_valid and not use_since:
+        # Served from the snapshot of the valid tags, which has all changes up
+        # to the version taken before it
+        version = current_app.snapshot_version
+        snapshot = current_snapshot()
+        version = max(version, snapshot.version)
+        if use_offset and current_app.coverage is not None:
+            tags = assign_tags(snapshot, relay, num_tags)
+            rendering = snapshot.pack(feed_format, tags)
+        elif use_offset and current_app.replicas is not None:
+            relay_slot(relay)  # marks the relay as active
+            tags = snapshot.shard(current_ring(relay), relay, current_app.replicas)
+            if len(tags) > num_tags:
+                ids = [t.id for t in tags]
+                start = bisect.bisect_right(ids, next_cursor(relay)) % len(tags)
+                tags = (tags[start:] + tags[:start])[:num_tags]
+                next_cursor(relay, tags[-1].id)
+            rendering = snapshot.pack(feed_format, tags)
+        else:
+            # Continue after the last tag returned to the relay, or start at
+            # the first tag
+            start = snapshot.after(next_cursor(relay)) if use_offset else 0
+            rendering, last_id = snapshot.render(feed_format, start, num_tags)
+            if use_offset and last_id is not None:
+                next_cursor(relay, last_id)
+        ret_val = Response(rendering, mimetype="application/json")
+        if feed_format == "bin":
+            ret_val.mimetype = "application/octet-stream"
+    while ret_val is None:
+        # Remember the change counter before querying, so we don't miss any
+        # change committed between the query and waiting for changes
+        seen_changes: int = current_app.changes.value
+        timeout: float = 0
+        with current_app.session() as session, session.begin():
+            query = session.query(AirTag).order_by(AirTag.id)
             now = datetime.datetime.now()
-            query = query.filter(AirTag._valid_from < now, now < AirTag._valid_to)
-            valid_count = query.count()
-        if use_offset:
-            # Offset the query
-            # Note: if offset + num_tags > total number of valid tags, only the last total - offset tags are returned
-            query = query.offset(current_app.offset)
-            # Set new offset or reset if it exceeds the number of available tags
-            next_offset: int = current_app.offset + num_tags
-            current_app.offset = next_offset if next_offset < valid_count else 0
-        if num_tags > 0:
-            # Limit query
-            query = query.limit(num_tags)
-
-        # Actually execute the query and retrieve the objects
-        airtags = query.all()
-        airtag_json = jsonify([a.to_dict() for a in airtags])
-
-    return airtag_json
+            version = current_version(now)
+            now_ts: float = now.timestamp()
+
+            if use_since:
+                # Only return the tags that were changed, became valid, or
+                # expired since the given version (which is a timestamp in us)
+                since_time: float = since / 1e6
+                query = query.filter(
+                    or_(
+                        AirTag._version > since,
+                        and_(
+                            since_time < AirTag._valid_from,
+                            AirTag._valid_from <= now_ts,
+                        ),
+                        and_(
+                            since_time < AirTag._valid_to,
+                            AirTag._valid_to <= now_ts,
+                        ),
+                    )
+                )
+
+            # Actually execute the query and retrieve the objects
+            if num_tags > 0 and not use_since:
+                airtags = query.limit(num_tags).all()
+            else:
+                airtags = query.all()
+            timeout = deadline - time.monotonic()
+            if use_since and not airtags and timeout > 0:
+                # Nothing changed yet => long-poll, but wake up at the latest
+                # when the next tag becomes valid or expires
+                boundaries = [
+                    session.query(func.min(column)).filter(column > now_ts).scalar()
+                    for column in [AirTag._valid_from, AirTag._valid_to]
+                ]
+                boundaries = [b for b in boundaries if b is not None]
+                if boundaries:
+                    timeout = min(timeout, min(boundaries) - now_ts)
+            elif use_since and not airtags:
+                return Response(
+                    status=304,
+                    headers={
+                        "X-Tag-Version": str(version),
+                        "X-Poll-After": str(poll_after()),
+                    },
+                )
+            elif feed_format == "bin":
+                feed = feed_header(len(airtags))
+                feed += b"".join(a.to_record() for a in airtags)
+                ret_val = Response(feed, mimetype="application/octet-stream")
+            else:
+                ret_val = Response(
+                    "[" + ",".join(a.to_json() for a in airtags) + "]",
+                    mimetype="application/json",
+                )
+        if ret_val is None:
+            wait_for_changes(seen_changes, timeout)
+
+    ret_val.headers["X-Tag-Version"] = str(version)
+    if not use_offset:
+        ret_val.headers["X-Poll-After"] = str(poll_after())
+    if current_app.policy is not None:
+        ret_val.headers["X-Tag-Policy"] = current_app.policy
+    if use_since:
+        ret_val.headers["X-Tag-Delta"] = "true"
+    return ret_val
 
 
 @app.route("/api/v1/airtag/<int:airtag_id>", methods=["GET"])
@@ -322,17 +1808,227 @@ def get_tag(airtag_id: int) -> Response:
     return ret_val
 
 
-def api_receiver(interface: str, port: int, session: Session):
+@app.route("/api/v1/coverage", methods=["POST"])
+def add_coverage() -> Tuple[str, int]:
+    """REST API function that records the air time a relay gave the tags
+
+    Relays report the air time of their tags since their last report in the
+    binary format given by COVERAGE_HEADER and COVERAGE_RECORD and identify
+    themselves via the relay parameter (see get_tags). The air time counts
+    towards the current coverage period, air time of tags that aren't valid
+    anymore is dropped.
+
+    Returns:
+        Tuple[str, int]: HTML error message and status code 400, or an empty
+                         response with status code 204
+    """
+    relay: str = request.args.get("relay", default="")
+    if len(relay.encode()) > MAX_RELAY_LEN:
+        return "Invalid relay", 400
+    report: bytes = request.get_data()
+    try:
+        magic, version, record_size, count, slot_ms = COVERAGE_HEADER.unpack_from(
+            report
+        )
+    except struct.error:
+        return "Invalid report", 400
+    if (
+        magic != COVERAGE_MAGIC
+        or version != COVERAGE_VERSION
+        or record_size < COVERAGE_RECORD.size
+        or len(report) < COVERAGE_HEADER.size + count * record_size
+    ):
+        return "Invalid report", 400
+
+    snapshot = current_snapshot()
+    airtime: Dict[int, int] = {}
+    for i in range(count):
+        airtag_id, slots = COVERAGE_RECORD.unpack_from(
+            report, COVERAGE_HEADER.size + i * record_size
+        )
+        if snapshot.find(airtag_id) is not None:
+            airtime[airtag_id] = airtime.get(airtag_id, 0) + slots * slot_ms
+    if not airtime:
+        return "", 204
+
+    period = int(time.time() // COVERAGE_PERIOD)
+    rows = [
+        {"period": period, "relay": relay, "airtag_id": i, "airtime": t}
+        for i, t in airtime.items()
+    ]
+    with current_app.write_session() as session, session.begin():
+        for i in range(0, len(rows), UPSERT_CHUNK):
+            stmt = insert(Coverage).values(rows[i : i + UPSERT_CHUNK])
+            stmt = stmt.on_conflict_do_update(
+                index_elements=["period", "relay", "airtag_id"],
+                set_={"airtime": Coverage.airtime + stmt.excluded.airtime},
+            )
+            session.execute(stmt)
+    return "", 204
+
+
+@app.route("/api/v1/coverage", methods=["GET"])
+def get_coverage() -> Response:
+    """REST API function that returns the coverage of the valid tags
+
+    Returns:
+        Response: Flask Response object with status code 200 and a JSON list
+                  with an object per valid tag, giving the number of relays
+                  covering it ("relays") and the air time (in s) they reported
+                  for it ("airtime") in the current coverage period, and
+                  whether that meets the coverage target ("covered", only if a
+                  target is configured)
+    """
+    snapshot = current_snapshot()
+    period = int(time.time() // COVERAGE_PERIOD)
+    with current_app.session() as session, session.begin():
+        coverage = {
+            airtag_id: (relays, airtime)
+            for airtag_id, relays, airtime in session.query(
+                Coverage.airtag_id, func.count(), func.sum(Coverage.airtime)
+            )
+            .filter(Coverage.period == period)
+            .group_by(Coverage.airtag_id)
+        }
+    tags = []
+    for tag in snapshot.tags:
+        relays, airtime = coverage.get(tag.id, (0, 0))
+        tags.append({"id": tag.id, "relays": relays, "airtime": airtime / 1000})
+        if current_app.coverage is not None:
+            tags[-1]["covered"] = relays >= current_app.coverage
+    return jsonify(tags)
+
+
+def api_receiver(
+    interface: str,
+    port: int,
+    sqlitedb: str,
+    policy: str = None,
+    commit_interval: float = None,
+    max_commit_tags: int = 1000,
+    workers: int = 0,
+    threads: int = 32,
+    retention: float = None,
+    coverage: int = None,
+    replicas: int = None,
+):
     """Starts up a webserver and listens for REST API requests
 
     Args:
         interface: network interface to listen on (as IP address, e.g., 0.0.0.0)
         port: TCP port to listen on
-        session: DB session for persisting data
+        sqlitedb: SQLite database file for persisting data
+        policy: tag scheduling policy to tell the relays to use (None to leave
+            it to their configuration)
+        commit_interval: maximum time (in s) uploaded AirTags are queued before
+            they're committed in write-behind mode (None to commit every upload
+            right away)
+        max_commit_tags: maximum number of AirTags per commit in write-behind
+            mode
+        workers: number of gunicorn worker processes (0 to use Flask's
+            development server instead)
+        threads: number of threads serving requests per worker process
+        retention: time (in s) to keep AirTags for after they expired (None to
+            keep them forever)
+        coverage: number of relays every tag should be assigned to per coverage
+            period (None to let relays rotate through the tags instead)
+        replicas: number of relays every tag belongs to when sharding the tags
+            across the relays (None to let relays rotate through the tags
+            instead)
     """
-    app.session = session
-    app.offset: int = 0
-    app.run(interface, port)
+    app.policy = policy
+    app.coverage = coverage
+    app.replicas = replicas
+    engine = connect(sqlitedb, 1)
+    with Session(engine) as s:
+        version = s.query(func.max(AirTag._version)).scalar() or 0
+        horizon = s.get(Meta, "compacted_before")
+    engine.dispose()
+    # State shared by the worker processes, so it's set up before forking them
+    app.version = mp.Value("q", version)
+    app.pending_version = mp.Value("q", 0, lock=False)
+    app.changes = mp.Value("q", 0, lock=False)
+    app.changes_cond = mp.Condition()
+    app.last_change = mp.Value("d", time.time(), lock=False)
+    app.threads = threads
+    app.relay_ids = mp.Array("c", CURSOR_SLOTS * RELAY_KEY_LEN)
+    app.cursors = mp.Array("q", CURSOR_SLOTS)
+    app.relays_seen = mp.Array("d", CURSOR_SLOTS)
+    app.next_compaction = mp.Value("d", 0.0)
+    app.compacted_before = mp.Value("q", horizon.value if horizon else 0)
+    # Uploads of all workers queue up for a single writer in write-behind mode
+    app.ingest_queue = None
+    if commit_interval is not None:
+        app.ingest_queue = mp.Queue(MAX_QUEUED)
+    app.writer_pid = mp.Value("i", 0)
+
+    def init_worker():
+        # Everything else is local to every worker process
+        app.session = sessionmaker(bind=connect(sqlitedb, threads))
+        app.write_engine = connect(sqlitedb, threads, immediate=True)
+        app.write_session = sessionmaker(bind=app.write_engine)
+        app.snapshot_lock = threading.Lock()
+        app.refresh_at = time.monotonic() + SNAPSHOT_REFRESH
+        app.ring = HashRing(frozenset())
+        app.ring_lock = threading.Lock()
+        app.ring_refresh_at = 0.0
+        app.busy = 0
+        app.busy_lock = threading.Lock()
+        with app.app_context(), app.session() as s:
+            version = current_version(datetime.datetime.now())
+            app.snapshot = Snapshot.load(s, time.time(), version)
+            app.snapshot_version = version
+        app.flush = lambda: None
+        # The first worker runs the writer, or one replacing it once it's gone
+        with app.writer_pid.get_lock():
+            if app.ingest_queue is not None and not process_alive(
+                app.writer_pid.value
+            ):
+                app.writer_pid.value = os.getpid()
+            is_writer = app.writer_pid.value == os.getpid()
+        if is_writer:
+            writer = threading.Thread(
+                target=ingest_writer,
+                args=(app.ingest_queue, commit_interval, max_commit_tags),
+                daemon=True,
+            )
+            writer.start()
+
+            def flush():
+                # Commit what's still queued on shutdown, then hand over
+                app.ingest_queue.put(None)
+                writer.join()
+                with app.writer_pid.get_lock():
+                    app.writer_pid.value = 0
+
+            app.flush = flush
+        if retention is not None:
+            threading.Thread(target=compactor, args=(retention,), daemon=True).start()
+
+    if workers == 0:
+        init_worker()
+        atexit.register(lambda: app.flush())
+        # Long-polling requests block their thread, so serve requests in threads
+        app.run(interface, port, threaded=True)
+        return
+
+    # Only needed for serving with multiple workers
+    from gunicorn.app.base import BaseApplication
+
+    class Server(BaseApplication):
+        def load_config(self):
+            self.cfg.set("bind", f"{interface}:{port}")
+            self.cfg.set("workers", workers)
+            # Long-polling requests block their thread, so use threaded workers
+            self.cfg.set("worker_class", "gthread")
+            self.cfg.set("threads", threads)
+            self.cfg.set("worker_exit", lambda arbiter, worker: app.flush())
+
+        def load(self):
+            init_worker()
+            return app
+
+    Server().run()
 
 
 if __name__ == "__main__":
@@ -353,6 +2049,71 @@ if __name__ == "__main__":
         default="airtags.db",
         help="SQLite database file to persist AirTag information",
     )
+    parser.add_argument(
+        "--policy",
+        choices=POLICIES,
+        default=None,
+        help="Tag scheduling policy for the relays, overriding their configuration",
+    )
+    parser.add_argument(
+        "--write-behind",
+        dest="commit_interval",
+        metavar="MS",
+        type=int,
+        default=None,
+        help="Acknowledge uploads right away and commit them in groups at least "
+        "every MS milliseconds (the window in which they may get lost)",
+    )
+    parser.add_argument(
+        "--commit-tags",
+        dest="max_commit_tags",
+        metavar="N",
+        type=int,
+        default=1000,
+        help="Commit earlier in write-behind mode once N tags are queued",
+    )
+    parser.add_argument(
+        "--retention",
+        metavar="HOURS",
+        type=float,
+        default=7 * 24,
+        help="Delete AirTags this long after they expired (0 to keep them forever). "
+        "Relays that don't sync for longer get the full tag set again.",
+    )
+    assignment = parser.add_mutually_exclusive_group()
+    assignment.add_argument(
+        "--coverage",
+        metavar="K",
+        type=int,
+        default=None,
+        help="Assign every rotating relay fixed tags per coverage period, so that "
+        "each tag gets at least K relays' worth of air time where possible "
+        "(default: relays rotate through the tags)",
+    )
+    assignment.add_argument(
+        "--replicas",
+        metavar="R",
+        type=int,
+        default=None,
+        help="Shard the tags across the rotating relays by consistent hashing, "
+        "with every tag held by R relays (default: relays rotate through the "
+        "tags)",
+    )
+    parser.add_argument(
+        "-w",
+        "--workers",
+        type=int,
+        default=0,
+        help="Number of worker processes to serve requests with via gunicorn "
+        "(0 to use Flask's development server)",
+    )
+    parser.add_argument(
+        "--threads",
+        type=int,
+        default=32,
+        help="Number of threads serving requests per worker process, each "
+        "long-polling relay occupies one",
+    )
     parser.add_argument(
         "-v",
         "--verbose",
@@ -368,10 +2129,25 @@ if __name__ == "__main__":
     verb_levels = [logging.WARNING, logging.INFO, logging.DEBUG]
     log.setLevel(verb_levels[min(len(verb_levels) - 1, args.verbosity)])
 
-    # Create database connection
-    engine = create_engine("sqlite:///" + args.sqlitedb)
+    # Create or migrate the database
+    engine = connect(args.sqlitedb, 1)
     Base.metadata.create_all(engine)
-    Session = sessionmaker(bind=engine)
+    migrate(engine)
+    engine.dispose()
 
     # Start server
-    api_receiver(interface=args.interface, port=args.port, session=Session)
+    api_receiver(
+        interface=args.interface,
+        port=args.port,
+        sqlitedb=args.sqlitedb,
+        policy=args.policy,
+        commit_interval=(
+            args.commit_interval / 1000 if args.commit_interval is not None else None
+        ),
+        max_commit_tags=args.max_commit_tags,
+        workers=args.workers,
+        threads=args.threads,
+        retention=args.retention * 3600 if args.retention > 0 else None,
+        coverage=args.coverage,
+        replicas=args.replicas,
+    )